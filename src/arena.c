@@ -0,0 +1,109 @@
+#include <string.h>
+#include <sys/mman.h>
+#include "arena.h"
+#include "xmalloc.h"
+
+/* The size of an arena's first chunk, including its header. */
+#define ARENA_MIN_CHUNK_SIZE 4096
+
+/*
+ * The size chunks stop growing at, which is that of a huge page on most
+ * systems. Chunks this big are aligned to it, so they can be backed by one.
+ */
+#define ARENA_MAX_CHUNK_SIZE (2 << 20)
+
+#undef MAX
+#undef MIN
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	size_t used;
+	char data[];
+};
+
+/*
+ * Create a chunk with room for at least size bytes.
+ */
+static struct arena_chunk *chunk_create(size_t size)
+{
+	size_t total = sizeof(struct arena_chunk) + size;
+	struct arena_chunk *chunk;
+	if (total >= ARENA_MAX_CHUNK_SIZE) {
+		/* Round up to a whole number of huge pages. */
+		total = (total + ARENA_MAX_CHUNK_SIZE - 1) & ~(size_t)(ARENA_MAX_CHUNK_SIZE - 1);
+		chunk = xaligned_alloc(ARENA_MAX_CHUNK_SIZE, total);
+#ifdef __linux__
+		/*
+		 * As in surface.c, ask for Transparent HugePages, which saves
+		 * a lot of page faults while the chunk is filled.
+		 */
+		madvise(chunk, total, MADV_HUGEPAGE);
+#endif
+	} else {
+		chunk = xmalloc(total);
+	}
+	chunk->next = NULL;
+	chunk->size = total - sizeof(struct arena_chunk);
+	chunk->used = 0;
+	return chunk;
+}
+
+void arena_destroy(struct arena *arena)
+{
+	struct arena_chunk *chunk = arena->head;
+	while (chunk != NULL) {
+		struct arena_chunk *next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+	*arena = (struct arena){ 0 };
+}
+
+/*
+ * Return size bytes of uninitialised memory, which lasts until the arena is
+ * destroyed.
+ */
+char *arena_alloc(struct arena *arena, size_t size)
+{
+	struct arena_chunk *chunk = arena->head;
+	if (chunk != NULL && chunk->size - chunk->used >= size) {
+		char *ptr = &chunk->data[chunk->used];
+		chunk->used += size;
+		return ptr;
+	}
+
+	size_t chunk_size = MIN(
+			MAX(2 * arena->chunk_size, ARENA_MIN_CHUNK_SIZE),
+			ARENA_MAX_CHUNK_SIZE);
+	if (sizeof(struct arena_chunk) + size > chunk_size) {
+		/*
+		 * This won't fit in a normal chunk, so give it one of its own,
+		 * behind the current one so that that can still be filled.
+		 */
+		chunk = chunk_create(size);
+		if (arena->head != NULL) {
+			chunk->next = arena->head->next;
+			arena->head->next = chunk;
+		} else {
+			arena->head = chunk;
+		}
+	} else {
+		chunk = chunk_create(chunk_size - sizeof(struct arena_chunk));
+		chunk->next = arena->head;
+		arena->head = chunk;
+		arena->chunk_size = chunk_size;
+	}
+	chunk->used = size;
+	return chunk->data;
+}
+
+char *arena_strdup(struct arena *arena, const char *s)
+{
+	size_t size = strlen(s) + 1;
+	char *ptr = arena_alloc(arena, size);
+	memcpy(ptr, s, size);
+	return ptr;
+}
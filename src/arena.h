@@ -0,0 +1,27 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+ * A bump allocator for strings which are all freed together, such as those
+ * owned by a string_vec. Allocations aren't aligned, so that strings can be
+ * packed next to each other.
+ *
+ * Memory comes from a list of chunks, each twice the size of the last up to
+ * a limit, so nothing is ever moved. A zero-initialised arena is empty.
+ */
+struct arena {
+	struct arena_chunk *head;
+	size_t chunk_size;
+};
+
+void arena_destroy(struct arena *arena);
+
+[[gnu::malloc]]
+char *arena_alloc(struct arena *arena, size_t size);
+
+[[gnu::malloc]]
+char *arena_strdup(struct arena *arena, const char *s);
+
+#endif /* ARENA_H */
@@ -258,9 +258,16 @@ struct string_ref_vec compgen_history_sort(struct string_ref_vec *programs, stru
 	struct string_ref_vec vec = {
 		.count = programs->count,
 		.size = programs->size,
-		.buf = xcalloc(programs->size, sizeof(*vec.buf))
+		.buf = xcalloc(programs->size, sizeof(*vec.buf)),
+		.sorted = SIZE_MAX,
+		.buffers = programs->buffers,
+		.num_buffers = programs->num_buffers
 	};
 
+	/* The new vector takes ownership of the folded strings. */
+	programs->buffers = NULL;
+	programs->num_buffers = 0;
+
 	size_t n_hist = 0;
 	for (ssize_t i = programs->count - 1; i >= 0; i--) {
 		if (programs->buf[i].history_score == 0) {
@@ -83,6 +83,7 @@ static enum matching_algorithm parse_matching_algorithm(const char *filename, si
 
 static bool parse_bool(const char *filename, size_t lineno, const char *str, bool *err);
 static uint32_t parse_char(const char *filename, size_t lineno, const char *str, bool *err);
+static char parse_delimiter(const char *filename, size_t lineno, const char *str, bool *err);
 static struct color parse_color(const char *filename, size_t lineno, const char *str, bool *err);
 static uint32_t parse_uint32(const char *filename, size_t lineno, const char *str, bool *err);
 static int32_t parse_int32(const char *filename, size_t lineno, const char *str, bool *err);
@@ -713,6 +714,31 @@ bool parse_option(struct tofi *tofi, const char *filename, size_t lineno, const
 		if (!err) {
 			tofi->print_index = val;
 		}
+	} else if (strcasecmp(option, "delimiter") == 0) {
+		char val = parse_delimiter(filename, lineno, value, &err);
+		if (!err) {
+			tofi->delimiter = val;
+		}
+	} else if (strcasecmp(option, "read0") == 0) {
+		bool val = parse_bool(filename, lineno, value, &err);
+		if (!err) {
+			tofi->read0 = val;
+		}
+	} else if (strcasecmp(option, "print0") == 0) {
+		bool val = parse_bool(filename, lineno, value, &err);
+		if (!err) {
+			tofi->print0 = val;
+		}
+	} else if (strcasecmp(option, "dedup") == 0) {
+		bool val = parse_bool(filename, lineno, value, &err);
+		if (!err) {
+			tofi->dedup = val;
+		}
+	} else if (strcasecmp(option, "dedup-count") == 0) {
+		bool val = parse_bool(filename, lineno, value, &err);
+		if (!err) {
+			tofi->dedup_count = val;
+		}
 	} else if (strcasecmp(option, "hide-input") == 0) {
 		bool val = parse_bool(filename, lineno, value, &err);
 		if (!err) {
@@ -734,6 +760,31 @@ bool parse_option(struct tofi *tofi, const char *filename, size_t lineno, const
 		if (!err) {
 			tofi->drun_launch = val;
 		}
+	} else if (strcasecmp(option, "drun-name-weight") == 0) {
+		int32_t val = parse_int32(filename, lineno, value, &err);
+		if (!err) {
+			tofi->drun_weights[DESKTOP_FIELD_NAME] = val;
+		}
+	} else if (strcasecmp(option, "drun-generic-name-weight") == 0) {
+		int32_t val = parse_int32(filename, lineno, value, &err);
+		if (!err) {
+			tofi->drun_weights[DESKTOP_FIELD_GENERIC_NAME] = val;
+		}
+	} else if (strcasecmp(option, "drun-keywords-weight") == 0) {
+		int32_t val = parse_int32(filename, lineno, value, &err);
+		if (!err) {
+			tofi->drun_weights[DESKTOP_FIELD_KEYWORDS] = val;
+		}
+	} else if (strcasecmp(option, "drun-exec-weight") == 0) {
+		int32_t val = parse_int32(filename, lineno, value, &err);
+		if (!err) {
+			tofi->drun_weights[DESKTOP_FIELD_EXEC] = val;
+		}
+	} else if (strcasecmp(option, "drun-comment-weight") == 0) {
+		int32_t val = parse_int32(filename, lineno, value, &err);
+		if (!err) {
+			tofi->drun_weights[DESKTOP_FIELD_COMMENT] = val;
+		}
 	} else if (strcasecmp(option, "drun-print-exec") == 0) {
 		log_warning("drun-print-exec is deprecated, as it is now always true.\n"
 				"           This option may be removed in a future version of tofi.\n");
@@ -754,6 +805,36 @@ bool parse_option(struct tofi *tofi, const char *filename, size_t lineno, const
 		if (!err) {
 			tofi->ascii_input = val;
 		}
+	} else if (strcasecmp(option, "filter-threads") == 0) {
+		uint32_t val = parse_uint32(filename, lineno, value, &err);
+		if (!err) {
+			tofi->filter_threads = val;
+		}
+	} else if (strcasecmp(option, "filter-threshold") == 0) {
+		uint32_t val = parse_uint32(filename, lineno, value, &err);
+		if (!err) {
+			tofi->filter_threshold = val;
+		}
+	} else if (strcasecmp(option, "index-threshold") == 0) {
+		uint32_t val = parse_uint32(filename, lineno, value, &err);
+		if (!err) {
+			tofi->index_threshold = val;
+		}
+	} else if (strcasecmp(option, "stream-input") == 0) {
+		bool val = parse_bool(filename, lineno, value, &err);
+		if (!err) {
+			tofi->stream_input = val;
+		}
+	} else if (strcasecmp(option, "stream-batch-size") == 0) {
+		uint32_t val = parse_uint32(filename, lineno, value, &err);
+		if (!err) {
+			tofi->stream_batch_size = val;
+		}
+	} else if (strcasecmp(option, "stream-redraw-rate") == 0) {
+		uint32_t val = parse_uint32(filename, lineno, value, &err);
+		if (!err) {
+			tofi->stream_redraw_rate = val;
+		}
 	} else if (strcasecmp(option, "late-keyboard-init") == 0) {
 		bool val = parse_bool(filename, lineno, value, &err);
 		if (!err) {
@@ -1014,6 +1095,9 @@ enum matching_algorithm parse_matching_algorithm(const char *filename, size_t li
 	if(strcasecmp(str, "prefix") == 0) {
 		return MATCHING_ALGORITHM_PREFIX;
 	}
+	if(strcasecmp(str, "typo") == 0) {
+		return MATCHING_ALGORITHM_TYPO;
+	}
 	PARSE_ERROR(filename, lineno, "Invalid matching algorithm \"%s\".\n", str);
 	if (err) {
 		*err = true;
@@ -1021,6 +1105,25 @@ enum matching_algorithm parse_matching_algorithm(const char *filename, size_t li
 	return 0;
 }
 
+/*
+ * Delimiters are searched for byte by byte, so have to be ASCII.
+ */
+char parse_delimiter(const char *filename, size_t lineno, const char *str, bool *err)
+{
+	bool char_err = false;
+	uint32_t ch = parse_char(filename, lineno, str, &char_err);
+	if (!char_err && ch > 0 && ch < 0x80) {
+		return ch;
+	}
+	if (!char_err) {
+		PARSE_ERROR(filename, lineno, "Delimiter \"%s\" must be a single ASCII character.\n", str);
+	}
+	if (err) {
+		*err = true;
+	}
+	return '\n';
+}
+
 struct color parse_color(const char *filename, size_t lineno, const char *str, bool *err)
 {
 	struct color color = hex_to_color(str);
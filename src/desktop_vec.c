@@ -1,8 +1,12 @@
 #include <glib.h>
 #include <stdbool.h>
+#include <string.h>
+#include "arena.h"
 #include "desktop_vec.h"
 #include "matching.h"
 #include "log.h"
+#include "nelem.h"
+#include "simd.h"
 #include "string_vec.h"
 #include "unicode.h"
 #include "xmalloc.h"
@@ -22,38 +26,173 @@ struct desktop_vec desktop_vec_create(void)
 
 void desktop_vec_destroy(struct desktop_vec *restrict vec)
 {
-	for (size_t i = 0; i < vec->count; i++) {
-		free(vec->buf[i].id);
-		free(vec->buf[i].name);
-		free(vec->buf[i].path);
-		free(vec->buf[i].keywords);
-	}
 	free(vec->buf);
+	arena_destroy(&vec->strings);
 }
 
 void desktop_vec_add(
 		struct desktop_vec *restrict vec,
 		const char *restrict id,
-		const char *restrict name,
 		const char *restrict path,
-		const char *restrict keywords)
+		const char *const fields[DESKTOP_NUM_FIELDS])
 {
 	if (vec->count == vec->size) {
 		vec->size *= 2;
 		vec->buf = xrealloc(vec->buf, vec->size * sizeof(vec->buf[0]));
 	}
-	vec->buf[vec->count].id = xstrdup(id);
-	vec->buf[vec->count].name = utf8_normalize(name);
-	if (vec->buf[vec->count].name == NULL) {
-		vec->buf[vec->count].name = xstrdup(name);
+	struct desktop_entry *app = &vec->buf[vec->count];
+	app->id = arena_strdup(&vec->strings, id);
+	app->path = arena_strdup(&vec->strings, path);
+	app->search_score = 0;
+	app->history_score = 0;
+	app->mask = 0;
+	for (size_t f = 0; f < DESKTOP_NUM_FIELDS; f++) {
+		struct desktop_field *field = &app->fields[f];
+		field->ascii = simd_is_ascii(fields[f]);
+		if (field->ascii) {
+			/*
+			 * ASCII is never changed by normalization, and keeps
+			 * its length when folded.
+			 */
+			field->str = arena_strdup(&vec->strings, fields[f]);
+			field->folded = arena_alloc(&vec->strings, strlen(field->str) + 1);
+			utf8_fold(field->str, field->folded);
+		} else {
+			char *normalized = utf8_normalize(fields[f]);
+			field->str = arena_strdup(
+					&vec->strings,
+					normalized != NULL ? normalized : fields[f]);
+			free(normalized);
+			char *folded = utf8_fold_dup(field->str);
+			field->folded = arena_strdup(&vec->strings, folded);
+			free(folded);
+		}
+		field->mask = match_mask(field->folded);
+		app->mask |= field->mask;
 	}
-	vec->buf[vec->count].path = xstrdup(path);
-	vec->buf[vec->count].keywords = xstrdup(keywords);
-	vec->buf[vec->count].search_score = 0;
-	vec->buf[vec->count].history_score = 0;
+	app->initials = match_initials(app->fields[DESKTOP_FIELD_NAME].str);
 	vec->count++;
 }
 
+static const char *path_basename(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	return slash == NULL ? path : slash + 1;
+}
+
+static bool is_shell(const char *name)
+{
+	const char *shells[] = { "sh", "bash", "dash", "ksh", "zsh" };
+	for (size_t i = 0; i < N_ELEM(shells); i++) {
+		if (strcmp(name, shells[i]) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Return the basename of the program an Exec key runs, which is often what
+ * people know an app by (e.g. "nautilus" for Files).
+ *
+ * A few common wrappers are looked through to find the program they run:
+ * env (with its options and VAR=value assignments), shells given a command
+ * with -c (skipping any assignments or exec at its start), and flatpak run,
+ * for which the command given with --command is used if there is one, or else
+ * the last part of the app ID (e.g. "firefox" for org.mozilla.firefox). Any
+ * other wrapper, such as a launcher script, is taken to be the program itself.
+ */
+[[nodiscard("memory leaked")]]
+static char *exec_basename(const char *exec)
+{
+	char **argv;
+	int argc;
+	if (!g_shell_parse_argv(exec, &argc, &argv, NULL)) {
+		/* Quoting is broken, so just take everything up to a space. */
+		char *program = g_strndup(exec, strcspn(exec, " "));
+		char *name = xstrdup(path_basename(program));
+		free(program);
+		return name;
+	}
+
+	char *name = NULL;
+	int i = 0;
+	while (i < argc && name == NULL) {
+		const char *program = path_basename(argv[i]);
+		i++;
+		if (strcmp(program, "env") == 0) {
+			while (i < argc && (argv[i][0] == '-' || strchr(argv[i], '=') != NULL)) {
+				if (strcmp(argv[i], "-S") == 0
+						|| strcmp(argv[i], "--split-string") == 0) {
+					/* The rest of the command is in one argument. */
+					if (i + 1 < argc) {
+						name = exec_basename(argv[i + 1]);
+					}
+					break;
+				}
+				if (strcmp(argv[i], "-u") == 0
+						|| strcmp(argv[i], "--unset") == 0
+						|| strcmp(argv[i], "-C") == 0
+						|| strcmp(argv[i], "--chdir") == 0) {
+					/* These options take a separate argument. */
+					i++;
+				}
+				i++;
+			}
+		} else if (is_shell(program)) {
+			while (i < argc && argv[i][0] == '-' && strcmp(argv[i], "-c") != 0) {
+				i++;
+			}
+			if (i + 1 < argc && strcmp(argv[i], "-c") == 0) {
+				name = exec_basename(argv[i + 1]);
+			} else if (i >= argc) {
+				name = xstrdup(program);
+			}
+			/* Otherwise, the shell is running a script. */
+		} else if (strcmp(program, "flatpak") == 0
+				&& i < argc && strcmp(argv[i], "run") == 0) {
+			i++;
+			const char *command = NULL;
+			while (i < argc && argv[i][0] == '-') {
+				if (strncmp(argv[i], "--command=", strlen("--command=")) == 0) {
+					command = &argv[i][strlen("--command=")];
+				}
+				i++;
+			}
+			if (command != NULL) {
+				name = xstrdup(path_basename(command));
+			} else if (i < argc) {
+				const char *dot = strrchr(argv[i], '.');
+				name = xstrdup(dot == NULL ? argv[i] : dot + 1);
+			}
+		} else if (strchr(program, '=') == NULL && strcmp(program, "exec") != 0) {
+			name = xstrdup(program);
+		}
+		/* Otherwise, this is part of a shell command before the program. */
+	}
+	if (name == NULL) {
+		/* There was nothing for the wrapper to run. */
+		name = xstrdup(path_basename(argv[0]));
+	}
+	g_strfreev(argv);
+	return name;
+}
+
+/*
+ * Get a localised string key, or an empty string if it doesn't exist, so that
+ * every field of an app is always present.
+ */
+[[nodiscard("memory leaked")]]
+static char *get_locale_string(GKeyFile *file, const char *group, const char *key)
+{
+	char *str = g_key_file_get_locale_string(file, group, key, NULL, NULL);
+	if (str == NULL) {
+		return xstrdup("");
+	}
+	/* Newlines would break the cache format. */
+	return g_strdelimit(str, "\n", ' ');
+}
+
 void desktop_vec_add_file(struct desktop_vec *vec, const char *id, const char *path)
 {
 	GKeyFile *file = g_key_file_new();
@@ -74,16 +213,7 @@ void desktop_vec_add_file(struct desktop_vec *vec, const char *id, const char *p
 		log_error("%s: No name found.\n", path);
 		goto cleanup_file;
 	}
-
-	/*
-	 * This is really a list rather than a string, but for the purposes of
-	 * matching against user input it's easier to just keep it as a string.
-	 */
-	char *keywords = g_key_file_get_locale_string(file, group, "Keywords", NULL, NULL);
-	if (keywords == NULL) {
-		keywords = xmalloc(1);
-		*keywords = '\0';
-	}
+	g_strdelimit(name, "\n", ' ');
 
 	gsize length;
 	gchar **list = g_key_file_get_string_list(file, group, "OnlyShowIn", &length, NULL);
@@ -92,7 +222,7 @@ void desktop_vec_add_file(struct desktop_vec *vec, const char *id, const char *p
 		g_strfreev(list);
 		list = NULL;
 		if (!match) {
-			goto cleanup_all;
+			goto cleanup_name;
 		}
 	}
 
@@ -102,14 +232,36 @@ void desktop_vec_add_file(struct desktop_vec *vec, const char *id, const char *p
 		g_strfreev(list);
 		list = NULL;
 		if (match) {
-			goto cleanup_all;
+			goto cleanup_name;
 		}
 	}
 
-	desktop_vec_add(vec, id, name, path, keywords);
+	char *fields[DESKTOP_NUM_FIELDS];
+	fields[DESKTOP_FIELD_NAME] = name;
+	fields[DESKTOP_FIELD_GENERIC_NAME] = get_locale_string(file, group, "GenericName");
+	/*
+	 * This is really a list rather than a string, but for the purposes of
+	 * matching against user input it's easier to just keep it as a string.
+	 */
+	fields[DESKTOP_FIELD_KEYWORDS] = get_locale_string(file, group, "Keywords");
+	fields[DESKTOP_FIELD_COMMENT] = get_locale_string(file, group, "Comment");
+
+	char *exec = g_key_file_get_string(file, group, "Exec", NULL);
+	if (exec == NULL) {
+		fields[DESKTOP_FIELD_EXEC] = xstrdup("");
+	} else {
+		fields[DESKTOP_FIELD_EXEC] = exec_basename(exec);
+		free(exec);
+	}
 
-cleanup_all:
-	free(keywords);
+	desktop_vec_add(vec, id, path, (const char *const *)fields);
+
+	for (size_t f = 0; f < DESKTOP_NUM_FIELDS; f++) {
+		if (f != DESKTOP_FIELD_NAME) {
+			free(fields[f]);
+		}
+	}
+cleanup_name:
 	free(name);
 cleanup_file:
 	g_key_file_unref(file);
@@ -119,17 +271,9 @@ static int cmpdesktopp(const void *restrict a, const void *restrict b)
 {
 	struct desktop_entry *restrict d1 = (struct desktop_entry *)a;
 	struct desktop_entry *restrict d2 = (struct desktop_entry *)b;
-	return strcmp(d1->name, d2->name);
-}
-
-static int cmpscorep(const void *restrict a, const void *restrict b)
-{
-	struct scored_string *restrict str1 = (struct scored_string *)a;
-	struct scored_string *restrict str2 = (struct scored_string *)b;
-
-	int hist_diff = str2->history_score - str1->history_score;
-	int search_diff = str2->search_score - str1->search_score;
-	return hist_diff + search_diff;
+	return strcmp(
+			d1->fields[DESKTOP_FIELD_NAME].str,
+			d2->fields[DESKTOP_FIELD_NAME].str);
 }
 
 void desktop_vec_sort(struct desktop_vec *restrict vec)
@@ -143,47 +287,132 @@ struct desktop_entry *desktop_vec_find_sorted(struct desktop_vec *restrict vec,
 	 * Explicitly cast away const-ness, as even though we won't modify the
 	 * name, the compiler rightly complains that we might.
 	 */
-	struct desktop_entry tmp = { .name = (char *)name };
+	struct desktop_entry tmp = {
+		.fields[DESKTOP_FIELD_NAME].str = (char *)name
+	};
 	return bsearch(&tmp, vec->buf, vec->count, sizeof(vec->buf[0]), cmpdesktopp);
 }
 
-struct string_ref_vec desktop_vec_filter(
+/*
+ * The body of desktop_vec_filter(), which is always inlined with a constant
+ * match function, so that we get a specialised loop for each algorithm.
+ *
+ * Each app's score is the best weighted score of any of its fields, so that
+ * e.g. a match against the name is preferred over one against the comment.
+ * Matching the initials of the name counts as a match against the name.
+ *
+ * If subset is not NULL, only the apps it refers to are checked.
+ */
+[[gnu::always_inline]]
+static inline void filter_with(
+		struct string_ref_vec *restrict filt,
 		const struct desktop_vec *restrict vec,
-		const char *restrict substr,
-		enum matching_algorithm algorithm)
+		const struct string_ref_vec *restrict subset,
+		const struct match_query *restrict query,
+		int32_t (*match)(
+			const struct match_query *restrict query,
+			const char *restrict str,
+			const char *restrict folded,
+			bool ascii))
 {
-	struct string_ref_vec filt = string_ref_vec_create();
-	for (size_t i = 0; i < vec->count; i++) {
-		int32_t search_score;
-		search_score = match_words(algorithm, substr, vec->buf[i].name);
-		if (search_score != INT32_MIN) {
-			string_ref_vec_add(&filt, vec->buf[i].name);
-			/* Store the score of the match for later sorting. */
-			filt.buf[filt.count - 1].search_score = search_score;
-			filt.buf[filt.count - 1].history_score = vec->buf[i].history_score;
-		} else {
-			/* If we didn't match the name, check the keywords. */
-			search_score = match_words(algorithm, substr, vec->buf[i].keywords);
-			if (search_score != INT32_MIN) {
-				string_ref_vec_add(&filt, vec->buf[i].name);
-				/*
-				 * Arbitrary score addition to make name
-				 * matches preferred over keyword matches.
-				 */
-				filt.buf[filt.count - 1].search_score = search_score - 20;
-				filt.buf[filt.count - 1].history_score = vec->buf[i].history_score;
+	const uint64_t mask = query->mask;
+	const size_t count = subset == NULL ? vec->count : subset->count;
+	for (size_t i = 0; i < count; i++) {
+		const uint32_t index = subset == NULL ? i : subset->buf[i].index;
+		const struct desktop_entry *app = &vec->buf[index];
+		if ((app->mask & mask) != mask) {
+			continue;
+		}
+		int64_t search_score = INT64_MIN;
+		for (size_t f = 0; f < DESKTOP_NUM_FIELDS; f++) {
+			const struct desktop_field *field = &app->fields[f];
+			if ((field->mask & mask) != mask || field->str[0] == '\0') {
+				continue;
 			}
+			int32_t score = match(query, field->str, field->folded, field->ascii);
+			if (score == INT32_MIN) {
+				continue;
+			}
+			int64_t weighted = (int64_t)score + vec->weights[f];
+			if (weighted > search_score) {
+				search_score = weighted;
+			}
+		}
+		int32_t acronym_score = match_query_acronym(query, app->initials);
+		if (acronym_score != INT32_MIN) {
+			int64_t weighted = (int64_t)acronym_score + vec->weights[DESKTOP_FIELD_NAME];
+			if (weighted > search_score) {
+				search_score = weighted;
+			}
+		}
+		if (search_score == INT64_MIN) {
+			continue;
 		}
+		/* INT32_MIN means no match, so keep clear of it. */
+		if (search_score <= INT32_MIN) {
+			search_score = INT32_MIN + 1;
+		} else if (search_score > INT32_MAX) {
+			search_score = INT32_MAX;
+		}
+		const struct desktop_field *name = &app->fields[DESKTOP_FIELD_NAME];
+		string_ref_vec_add(filt, name->str);
+		/* Store the score of the match for later sorting. */
+		filt->buf[filt->count - 1].search_score = search_score;
+		filt->buf[filt->count - 1].history_score = app->history_score;
+		filt->buf[filt->count - 1].folded = name->folded;
+		filt->buf[filt->count - 1].mask = name->mask;
+		filt->buf[filt->count - 1].initials = app->initials;
+		filt->buf[filt->count - 1].index = index;
+		filt->buf[filt->count - 1].ascii = name->ascii;
+	}
+}
+
+struct string_ref_vec desktop_vec_filter(
+		const struct desktop_vec *restrict vec,
+		const struct match_query *restrict query)
+{
+	return desktop_vec_filter_results(vec, NULL, query);
+}
+
+/*
+ * Like desktop_vec_filter(), but only check the apps in results (which
+ * should have come from a previous call to one of these functions), for
+ * quickly narrowing down a previous search.
+ */
+struct string_ref_vec desktop_vec_filter_results(
+		const struct desktop_vec *restrict vec,
+		const struct string_ref_vec *restrict results,
+		const struct match_query *restrict query)
+{
+	struct string_ref_vec filt = string_ref_vec_create();
+	switch (query->algorithm) {
+		case MATCHING_ALGORITHM_NORMAL:
+			filter_with(&filt, vec, results, query, match_query_normal);
+			break;
+		case MATCHING_ALGORITHM_PREFIX:
+			filter_with(&filt, vec, results, query, match_query_prefix);
+			break;
+		case MATCHING_ALGORITHM_FUZZY:
+			filter_with(&filt, vec, results, query, match_query_fuzzy);
+			break;
+		case MATCHING_ALGORITHM_TYPO:
+			filter_with(&filt, vec, results, query, match_query_typo);
+			break;
 	}
 	/*
-	 * Sort the results by this search_score. This moves matches at the beginnings
-	 * of words to the front of the result list.
+	 * Sort the best results by this search_score. This moves matches at
+	 * the beginnings of words to the front of the result list.
 	 */
-	qsort(filt.buf, filt.count, sizeof(filt.buf[0]), cmpscorep);
+	string_ref_vec_sort_partial(&filt);
 	return filt;
 }
 
-struct desktop_vec desktop_vec_load(FILE *file)
+/*
+ * Load a cache written by desktop_vec_save(). If any line doesn't have the
+ * right number of fields, which is the case for caches written by older
+ * versions of tofi, err is set and the cache should be regenerated.
+ */
+struct desktop_vec desktop_vec_load(FILE *file, bool *err)
 {
 	struct desktop_vec vec = desktop_vec_create();
 	if (file == NULL) {
@@ -196,15 +425,27 @@ struct desktop_vec desktop_vec_load(FILE *file)
 	while ((bytes_read = getline(&line, &len, file)) != -1) {
 		if (line[bytes_read - 1] == '\n') {
 			line[bytes_read - 1] = '\0';
+			bytes_read--;
+		}
+		size_t separators = 0;
+		for (ssize_t i = 0; i < bytes_read; i++) {
+			if (line[i] == '\0') {
+				separators++;
+			}
+		}
+		if (separators != DESKTOP_NUM_FIELDS + 1) {
+			*err = true;
+			break;
 		}
 		char *id = line;
-		size_t sublen = strlen(line);
-		char *name = &line[sublen + 1];
-		sublen = strlen(name);
-		char *path = &name[sublen + 1];
-		sublen = strlen(path);
-		char *keywords = &path[sublen + 1];
-		desktop_vec_add(&vec, id, name, path, keywords);
+		char *path = &id[strlen(id) + 1];
+		const char *fields[DESKTOP_NUM_FIELDS];
+		const char *next = &path[strlen(path) + 1];
+		for (size_t f = 0; f < DESKTOP_NUM_FIELDS; f++) {
+			fields[f] = next;
+			next += strlen(next) + 1;
+		}
+		desktop_vec_add(&vec, id, path, fields);
 	}
 	free(line);
 
@@ -220,11 +461,11 @@ void desktop_vec_save(struct desktop_vec *restrict vec, FILE *restrict file)
 	for (size_t i = 0; i < vec->count; i++) {
 		fputs(vec->buf[i].id, file);
 		fputc('\0', file);
-		fputs(vec->buf[i].name, file);
-		fputc('\0', file);
 		fputs(vec->buf[i].path, file);
-		fputc('\0', file);
-		fputs(vec->buf[i].keywords, file);
+		for (size_t f = 0; f < DESKTOP_NUM_FIELDS; f++) {
+			fputc('\0', file);
+			fputs(vec->buf[i].fields[f].str, file);
+		}
 		fputc('\n', file);
 	}
 }
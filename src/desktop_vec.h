@@ -5,21 +5,53 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <stdint.h>
+#include "arena.h"
 #include "matching.h"
 
+/* The fields of a desktop entry which are searched, in cache order. */
+enum desktop_field_id {
+	DESKTOP_FIELD_NAME,
+	DESKTOP_FIELD_GENERIC_NAME,
+	DESKTOP_FIELD_KEYWORDS,
+	DESKTOP_FIELD_EXEC,
+	DESKTOP_FIELD_COMMENT,
+	DESKTOP_NUM_FIELDS
+};
+
+/*
+ * A searchable field, along with everything about it that can be worked out
+ * before searching.
+ */
+struct desktop_field {
+	char *str;
+	char *folded;
+	uint64_t mask;
+	bool ascii;
+};
+
 struct desktop_entry {
 	char *id;
-	char *name;
 	char *path;
-	char *keywords;
 	uint32_t search_score;
 	uint32_t history_score;
+	/*
+	 * The union of each field's mask, so that apps which can't match any
+	 * of their fields are rejected with a single check.
+	 */
+	uint64_t mask;
+	/* The match_initials() of the name. */
+	uint64_t initials;
+	struct desktop_field fields[DESKTOP_NUM_FIELDS];
 };
 
 struct desktop_vec {
 	size_t count;
 	size_t size;
 	struct desktop_entry *buf;
+	/* Storage for all of the strings of each entry. */
+	struct arena strings;
+	/* Added to the score of a match against each field. */
+	int32_t weights[DESKTOP_NUM_FIELDS];
 };
 
 [[nodiscard("memory leaked")]]
@@ -28,19 +60,21 @@ void desktop_vec_destroy(struct desktop_vec *restrict vec);
 void desktop_vec_add(
 		struct desktop_vec *restrict vec,
 		const char *restrict id,
-		const char *restrict name,
 		const char *restrict path,
-		const char *restrict keywords);
+		const char *const fields[DESKTOP_NUM_FIELDS]);
 void desktop_vec_add_file(struct desktop_vec *desktop, const char *id, const char *path);
 
 void desktop_vec_sort(struct desktop_vec *restrict vec);
 struct desktop_entry *desktop_vec_find_sorted(struct desktop_vec *restrict vec, const char *name);
 struct string_ref_vec desktop_vec_filter(
 		const struct desktop_vec *restrict vec,
-		const char *restrict substr,
-		enum matching_algorithm algorithm);
+		const struct match_query *restrict query);
+struct string_ref_vec desktop_vec_filter_results(
+		const struct desktop_vec *restrict vec,
+		const struct string_ref_vec *restrict results,
+		const struct match_query *restrict query);
 
-struct desktop_vec desktop_vec_load(FILE *file);
+struct desktop_vec desktop_vec_load(FILE *file, bool *err);
 void desktop_vec_save(struct desktop_vec *restrict vec, FILE *restrict file);
 
 
@@ -266,6 +266,26 @@ struct desktop_vec drun_generate_cached()
 	string_vec_destroy(&application_path);
 
 	struct desktop_vec apps;
+	if (!out_of_date) {
+		log_debug("Cache up to date, loading.\n");
+		errno = 0;
+		FILE *cache = fopen(cache_path, "rb");
+		if (cache == NULL) {
+			log_error("Failed to load cache: %s.\n", strerror(errno));
+			log_indent();
+			apps = drun_generate();
+			log_unindent();
+		} else {
+			bool err = false;
+			apps = desktop_vec_load(cache, &err);
+			fclose(cache);
+			if (err) {
+				log_debug("Cache in an old format.\n");
+				desktop_vec_destroy(&apps);
+				out_of_date = true;
+			}
+		}
+	}
 	if (out_of_date) {
 		log_debug("Cache out of date, updating.\n");
 		log_indent();
@@ -279,19 +299,6 @@ struct desktop_vec drun_generate_cached()
 			desktop_vec_save(&apps, cache);
 			fclose(cache);
 		}
-	} else {
-		log_debug("Cache up to date, loading.\n");
-		errno = 0;
-		FILE *cache = fopen(cache_path, "rb");
-		if (cache == NULL) {
-			log_error("Failed to load cache: %s.\n", strerror(errno));
-			log_indent();
-			apps = drun_generate();
-			log_unindent();
-		} else {
-			apps = desktop_vec_load(cache);
-			fclose(cache);
-		}
 	}
 	free(cache_path);
 	return apps;
@@ -262,6 +262,7 @@ void entry_destroy(struct entry *entry)
 	cairo_destroy(entry->cairo[1].cr);
 	cairo_surface_destroy(entry->cairo[0].surface);
 	cairo_surface_destroy(entry->cairo[1].surface);
+	match_query_destroy(&entry->query);
 }
 
 void entry_update(struct entry *entry)
@@ -9,6 +9,7 @@
 #include "color.h"
 #include "desktop_vec.h"
 #include "history.h"
+#include "result_cache.h"
 #include "surface.h"
 #include "string_vec.h"
 
@@ -84,10 +85,15 @@ struct entry {
 	uint32_t selection;
 	uint32_t first_result;
 	char *command_buffer;
+	/* The length of command_buffer, if it's a mapping of stdin. */
+	size_t command_buffer_mapped;
 	struct string_ref_vec results;
 	struct string_ref_vec commands;
 	struct desktop_vec apps;
 	struct history history;
+	struct result_cache result_cache;
+	/* The current input, compiled for highlighting matches. */
+	struct match_query query;
 	bool use_pango;
 
 	uint32_t clip_x;
@@ -133,21 +133,31 @@ static cairo_text_extents_t render_hb_buffer(cairo_t *cr, hb_font_extents_t *fon
 }
 
 /*
- * Clear the harfbuzz buffer, shape some text and render it with Cairo,
- * returning the extents of the rendered text in Cairo units.
+ * Clear the harfbuzz buffer, shape the first len bytes of some text (or all
+ * of it, if len is -1) and render it with Cairo, returning the extents of the
+ * rendered text in Cairo units.
  */
-static cairo_text_extents_t render_text(
+static cairo_text_extents_t render_text_len(
 		cairo_t *cr,
 		struct entry_backend_harfbuzz *hb,
-		const char *text)
+		const char *text,
+		int len)
 {
 	hb_buffer_clear_contents(hb->hb_buffer);
 	setup_hb_buffer(hb->hb_buffer);
-	hb_buffer_add_utf8(hb->hb_buffer, text, -1, 0, -1);
+	hb_buffer_add_utf8(hb->hb_buffer, text, len, 0, len);
 	hb_shape(hb->hb_font, hb->hb_buffer, hb->hb_features, hb->num_features);
 	return render_hb_buffer(cr, &hb->hb_font_extents, hb->hb_buffer, hb->scale);
 }
 
+static cairo_text_extents_t render_text(
+		cairo_t *cr,
+		struct entry_backend_harfbuzz *hb,
+		const char *text)
+{
+	return render_text_len(cr, hb, text, -1);
+}
+
 /*
  * Render the background box for a piece of text with the given theme and text
  * extents.
@@ -754,6 +764,8 @@ void entry_backend_harfbuzz_update(struct entry *entry)
 		if (index >= entry->results.count) {
 			break;
 		}
+		/* Results are only sorted as far as they're needed. */
+		string_ref_vec_sort_until(&entry->results, index + 1);
 
 		const char *result = entry->results.buf[index].string;
 		/*
@@ -814,8 +826,9 @@ void entry_backend_harfbuzz_update(struct entry *entry)
 			/*
 			 * For match highlighting, there's a bit more to do.
 			 *
-			 * We need to split the text into prematch, match and
-			 * postmatch chunks, and draw each separately.
+			 * We need to split the text into alternating chunks
+			 * of unmatched and matched text, as found by the
+			 * matcher, and draw each separately.
 			 *
 			 * However, we only want one background box around them
 			 * all (if we're drawing one). To do this, we have to
@@ -829,41 +842,38 @@ void entry_backend_harfbuzz_update(struct entry *entry)
 			 * as it's currently not possible for the selection to
 			 * do so.
 			 */
-			size_t prematch_len;
-			size_t postmatch_len;
-			char *prematch = xstrdup(result);
-			char *match = NULL;
-			char *postmatch = NULL;
-			if (entry->input_utf8_length > 0 && entry->selection_highlight_color.a != 0) {
-				char *match_pos = utf8_strcasestr(prematch, entry->input_utf8);
-				if (match_pos != NULL) {
-					match = xstrdup(result);
-					prematch_len = (match_pos - prematch);
-					prematch[prematch_len] = '\0';
-					postmatch_len = strlen(result) - prematch_len - entry->input_utf8_length;
-					if (postmatch_len > 0) {
-						postmatch = xstrdup(result);
-					}
-					match[entry->input_utf8_length + prematch_len] = '\0';
-				}
+			const struct scored_string_ref *ref = &entry->results.buf[index];
+			struct match_spans spans = { 0 };
+			if (entry->query.count > 0 && ref->folded != NULL) {
+				match_query_spans(&entry->query, result, ref->folded, ref->ascii, &spans);
 			}
+			const size_t len = strlen(result);
 
 			for (int pass = 0; pass < 2; pass++) {
 				cairo_save(cr);
-				struct color color = entry->selection_theme.foreground_color;
-				cairo_set_source_rgba(cr, color.r, color.g, color.b, color.a);
-
-				cairo_text_extents_t subextents = render_text(cr, &entry->harfbuzz, prematch);
-				extents = subextents;
-
-				if (match != NULL) {
-					cairo_translate(cr, subextents.x_advance, 0);
-					color = entry->selection_highlight_color;
+				extents = (cairo_text_extents_t){ 0 };
+				cairo_text_extents_t subextents = { 0 };
+
+				size_t pos = 0;
+				size_t span = 0;
+				while (pos < len) {
+					size_t end;
+					struct color color;
+					if (span < spans.count && pos == spans.span[span].start) {
+						end = spans.span[span].end;
+						color = entry->selection_highlight_color;
+						span++;
+					} else {
+						end = span < spans.count ? spans.span[span].start : len;
+						color = entry->selection_theme.foreground_color;
+					}
+					if (pos > 0) {
+						cairo_translate(cr, subextents.x_advance, 0);
+					}
 					cairo_set_source_rgba(cr, color.r, color.g, color.b, color.a);
+					subextents = render_text_len(cr, &entry->harfbuzz, &result[pos], end - pos);
 
-					subextents = render_text(cr, &entry->harfbuzz, &match[prematch_len]);
-
-					if (prematch_len == 0) {
+					if (pos == 0) {
 						extents = subextents;
 					} else {
 						/*
@@ -871,12 +881,13 @@ void entry_backend_harfbuzz_update(struct entry *entry)
 						 * complex, but it's basically:
 						 *
 						 * (distance from leftmost pixel of
-						 * prematch to logical end of prematch)
-						 * 
+						 * previous chunks to logical end of
+						 * previous chunks)
+						 *
 						 * +
 						 *
-						 * (distance from logical start of match
-						 * to rightmost pixel of match).
+						 * (distance from logical start of this
+						 * chunk to rightmost pixel of it).
 						 */
 						extents.width = extents.x_advance
 							- extents.x_bearing
@@ -884,22 +895,7 @@ void entry_backend_harfbuzz_update(struct entry *entry)
 							+ subextents.width;
 						extents.x_advance += subextents.x_advance;
 					}
-				}
-
-				if (postmatch != NULL) {
-					cairo_translate(cr, subextents.x_advance, 0);
-					color = entry->selection_theme.foreground_color;
-					cairo_set_source_rgba(cr, color.r, color.g, color.b, color.a);
-					subextents = render_text(
-							cr,
-							&entry->harfbuzz,
-							&postmatch[entry->input_utf8_length + prematch_len]);
-
-					extents.width = extents.x_advance
-						- extents.x_bearing
-						+ subextents.x_bearing
-						+ subextents.width;
-					extents.x_advance += subextents.x_advance;
+					pos = end;
 				}
 
 				cairo_restore(cr);
@@ -915,14 +911,6 @@ void entry_backend_harfbuzz_update(struct entry *entry)
 					render_text_background(cr, entry, extents, &entry->selection_theme);
 				}
 			}
-
-			free(prematch);
-			if (match != NULL) {
-				free(match);
-			}
-			if (postmatch != NULL) {
-				free(postmatch);
-			}
 		}
 	}
 	entry->num_results_drawn = i;
@@ -408,6 +408,8 @@ void entry_backend_pango_update(struct entry *entry)
 		if (index >= entry->results.count) {
 			break;
 		}
+		/* Results are only sorted as far as they're needed. */
+		string_ref_vec_sort_until(&entry->results, index + 1);
 
 		const char *str;
 		if (i < entry->results.count) {
@@ -415,6 +417,15 @@ void entry_backend_pango_update(struct entry *entry)
 		} else {
 			str = "";
 		}
+		/*
+		 * Lines are kept exactly as they were read, so may not be
+		 * valid UTF-8, which Pango won't take. Draw a valid copy of
+		 * them instead, which matching treats the same way.
+		 */
+		char *valid_str = utf8_make_valid(str);
+		if (valid_str != NULL) {
+			str = valid_str;
+		}
 		if (i != entry->selection || (entry->selection_highlight_color.a == 0)) {
 			const struct text_theme *theme;
 			if (i == entry->selection) {
@@ -430,6 +441,7 @@ void entry_backend_pango_update(struct entry *entry)
 			} else if (!entry->horizontal) {
 				if (size_overflows(entry, 0, logical_rect.height)) {
 					entry->num_results_drawn = i;
+					free(valid_str);
 					break;
 				} else {
 					render_text_themed(cr, entry, str, theme, &ink_rect, &logical_rect);
@@ -442,6 +454,7 @@ void entry_backend_pango_update(struct entry *entry)
 				if (size_overflows(entry, logical_rect.width, 0)) {
 					entry->num_results_drawn = i;
 					cairo_pattern_destroy(group);
+					free(valid_str);
 					break;
 				} else {
 					cairo_save(cr);
@@ -452,43 +465,45 @@ void entry_backend_pango_update(struct entry *entry)
 				}
 			}
 		} else {
-			ssize_t prematch_len = -1;
-			ssize_t postmatch_len = -1;
-			size_t match_len = entry->input_utf8_length;
+			/*
+			 * Draw alternating chunks of unmatched and matched
+			 * text, as found by the matcher.
+			 */
+			const struct scored_string_ref *ref = &entry->results.buf[index];
+			struct match_spans spans = { 0 };
+			if (entry->query.count > 0 && ref->folded != NULL) {
+				match_query_spans(&entry->query, str, ref->folded, ref->ascii, &spans);
+			}
+			const size_t len = strlen(str);
 			PangoRectangle ink_subrect;
 			PangoRectangle logical_subrect;
-			if (entry->input_utf8_length > 0 && entry->selection_highlight_color.a != 0) {
-				char *match_pos = utf8_strcasestr(str, entry->input_utf8);
-				if (match_pos != NULL) {
-					prematch_len = (match_pos - str);
-					postmatch_len = strlen(str) - prematch_len - match_len;
-					if (postmatch_len <= 0) {
-						postmatch_len = -1;
-					}
-				}
-			}
 
 			for (int pass = 0; pass < 2; pass++) {
 				cairo_save(cr);
-				color = entry->selection_theme.foreground_color;
-				cairo_set_source_rgba(cr, color.r, color.g, color.b, color.a);
-
-				pango_layout_set_text(layout, str, prematch_len);
-				pango_cairo_update_layout(cr, layout);
-				pango_cairo_show_layout(cr, layout);
-				pango_layout_get_pixel_extents(entry->pango.layout, &ink_subrect, &logical_subrect);
-				ink_rect = ink_subrect;
-				logical_rect = logical_subrect;
-
-				if (prematch_len != -1) {
-					cairo_translate(cr, logical_subrect.x + logical_subrect.width, 0);
-					color = entry->selection_highlight_color;
+				ink_rect = (PangoRectangle){ 0 };
+				logical_rect = (PangoRectangle){ 0 };
+
+				size_t pos = 0;
+				size_t span = 0;
+				while (pos < len) {
+					size_t end;
+					if (span < spans.count && pos == spans.span[span].start) {
+						end = spans.span[span].end;
+						color = entry->selection_highlight_color;
+						span++;
+					} else {
+						end = span < spans.count ? spans.span[span].start : len;
+						color = entry->selection_theme.foreground_color;
+					}
+					if (pos > 0) {
+						cairo_translate(cr, logical_subrect.x + logical_subrect.width, 0);
+					}
 					cairo_set_source_rgba(cr, color.r, color.g, color.b, color.a);
-					pango_layout_set_text(layout, &str[prematch_len], match_len);
+					pango_layout_set_text(layout, &str[pos], end - pos);
 					pango_cairo_update_layout(cr, layout);
 					pango_cairo_show_layout(cr, layout);
 					pango_layout_get_pixel_extents(entry->pango.layout, &ink_subrect, &logical_subrect);
-					if (prematch_len == 0) {
+					if (pos == 0) {
 						ink_rect = ink_subrect;
 						logical_rect = logical_subrect;
 					} else {
@@ -498,22 +513,7 @@ void entry_backend_pango_update(struct entry *entry)
 							+ ink_subrect.width;
 						logical_rect.width += logical_subrect.x + logical_subrect.width;
 					}
-				}
-
-				if (postmatch_len != -1) {
-					cairo_translate(cr, logical_subrect.x + logical_subrect.width, 0);
-					color = entry->selection_theme.foreground_color;
-					cairo_set_source_rgba(cr, color.r, color.g, color.b, color.a);
-					pango_layout_set_text(layout, &str[prematch_len + match_len], -1);
-					pango_cairo_update_layout(cr, layout);
-					pango_cairo_show_layout(cr, layout);
-					pango_layout_get_pixel_extents(entry->pango.layout, &ink_subrect, &logical_subrect);
-					ink_rect.width = logical_rect.width
-						- ink_rect.x
-						+ ink_subrect.x
-						+ ink_subrect.width;
-					logical_rect.width += logical_subrect.x + logical_subrect.width;
-
+					pos = end;
 				}
 
 				cairo_restore(cr);
@@ -540,6 +540,7 @@ void entry_backend_pango_update(struct entry *entry)
 				}
 			}
 		}
+		free(valid_str);
 	}
 	entry->num_results_drawn = i;
 	log_debug("Drew %zu results.\n", i);
@@ -0,0 +1,218 @@
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <threads.h>
+#include <unistd.h>
+#include "filter_worker.h"
+#include "log.h"
+#include "xmalloc.h"
+
+static int worker_main(void *data)
+{
+	struct filter_worker *worker = data;
+	mtx_lock(&worker->lock);
+	while (true) {
+		while (!worker->quit && worker->text == NULL) {
+			cnd_wait(&worker->work_ready, &worker->lock);
+		}
+		if (worker->quit) {
+			break;
+		}
+
+		/* Take the latest request, and run it without the lock. */
+		char *text = worker->text;
+		uint64_t generation = worker->requested;
+		worker->text = NULL;
+		atomic_store(&worker->cancel, false);
+		mtx_unlock(&worker->lock);
+
+		struct string_ref_vec results = worker->func(
+				worker->arg,
+				text,
+				&worker->cancel);
+		free(text);
+
+		mtx_lock(&worker->lock);
+		if (generation != worker->requested) {
+			/* There's been a newer request since, so these are stale. */
+			string_ref_vec_destroy(&results);
+			continue;
+		}
+		if (worker->have_results) {
+			string_ref_vec_destroy(&worker->results);
+		}
+		worker->results = results;
+		worker->have_results = true;
+		worker->completed = generation;
+		cnd_broadcast(&worker->work_done);
+
+		uint64_t one = 1;
+		if (write(worker->event_fd, &one, sizeof(one)) == -1) {
+			log_error("Failed to signal filter completion: %s\n", strerror(errno));
+		}
+	}
+	mtx_unlock(&worker->lock);
+	return 0;
+}
+
+/*
+ * Start the worker thread. func(arg, text, cancel) will be called on it for
+ * each request.
+ */
+bool filter_worker_init(
+		struct filter_worker *worker,
+		struct string_ref_vec (*func)(
+			void *arg,
+			const char *text,
+			const atomic_bool *cancel),
+		void *arg)
+{
+	*worker = (struct filter_worker){
+		.func = func,
+		.arg = arg
+	};
+	worker->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (worker->event_fd == -1) {
+		log_error("Failed to create filter eventfd: %s\n", strerror(errno));
+		return false;
+	}
+	if (mtx_init(&worker->lock, mtx_plain) != thrd_success) {
+		log_error("Failed to create filter worker mutex.\n");
+		goto cleanup_event_fd;
+	}
+	if (cnd_init(&worker->work_ready) != thrd_success) {
+		log_error("Failed to create filter worker condition variable.\n");
+		goto cleanup_lock;
+	}
+	if (cnd_init(&worker->work_done) != thrd_success) {
+		log_error("Failed to create filter worker condition variable.\n");
+		goto cleanup_work_ready;
+	}
+	if (thrd_create(&worker->thread, worker_main, worker) != thrd_success) {
+		log_error("Failed to create filter worker thread.\n");
+		goto cleanup_work_done;
+	}
+	worker->running = true;
+	return true;
+
+cleanup_work_done:
+	cnd_destroy(&worker->work_done);
+cleanup_work_ready:
+	cnd_destroy(&worker->work_ready);
+cleanup_lock:
+	mtx_destroy(&worker->lock);
+cleanup_event_fd:
+	close(worker->event_fd);
+	worker->event_fd = -1;
+	return false;
+}
+
+void filter_worker_destroy(struct filter_worker *worker)
+{
+	if (!worker->running) {
+		return;
+	}
+	mtx_lock(&worker->lock);
+	worker->quit = true;
+	atomic_store(&worker->cancel, true);
+	cnd_signal(&worker->work_ready);
+	mtx_unlock(&worker->lock);
+	thrd_join(worker->thread, NULL);
+
+	free(worker->text);
+	if (worker->have_results) {
+		string_ref_vec_destroy(&worker->results);
+	}
+	close(worker->event_fd);
+	cnd_destroy(&worker->work_done);
+	cnd_destroy(&worker->work_ready);
+	mtx_destroy(&worker->lock);
+	*worker = (struct filter_worker){ 0 };
+}
+
+/*
+ * Ask for a search for text, cancelling any search that's still in progress.
+ * Returns false if the worker isn't running, in which case the caller should
+ * do the search itself.
+ */
+bool filter_worker_request(struct filter_worker *worker, const char *text)
+{
+	if (!worker->running) {
+		return false;
+	}
+	mtx_lock(&worker->lock);
+	free(worker->text);
+	worker->text = xstrdup(text);
+	worker->requested++;
+	atomic_store(&worker->cancel, true);
+	cnd_signal(&worker->work_ready);
+	mtx_unlock(&worker->lock);
+	return true;
+}
+
+/*
+ * If the results of the latest request have arrived since the last call,
+ * move them to results and return true. This should be called whenever
+ * event_fd is readable.
+ */
+bool filter_worker_collect(
+		struct filter_worker *worker,
+		struct string_ref_vec *results)
+{
+	if (!worker->running) {
+		return false;
+	}
+	uint64_t count;
+	if (read(worker->event_fd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+		log_error("Failed to read filter eventfd: %s\n", strerror(errno));
+	}
+
+	mtx_lock(&worker->lock);
+	bool have_results = worker->have_results;
+	if (have_results) {
+		*results = worker->results;
+		worker->results = (struct string_ref_vec){ 0 };
+		worker->have_results = false;
+	}
+	mtx_unlock(&worker->lock);
+	return have_results;
+}
+
+/*
+ * Wait for the latest request to finish, then collect its results as with
+ * filter_worker_collect().
+ */
+bool filter_worker_wait(
+		struct filter_worker *worker,
+		struct string_ref_vec *results)
+{
+	if (!worker->running) {
+		return false;
+	}
+	mtx_lock(&worker->lock);
+	while (worker->completed != worker->requested) {
+		cnd_wait(&worker->work_done, &worker->lock);
+	}
+	mtx_unlock(&worker->lock);
+	return filter_worker_collect(worker, results);
+}
+
+/*
+ * Return true if there's no search in progress and no results waiting to be
+ * collected, in which case the worker isn't touching anything func uses, and
+ * the results currently being shown are those of the latest request.
+ */
+bool filter_worker_idle(struct filter_worker *worker)
+{
+	if (!worker->running) {
+		return true;
+	}
+	mtx_lock(&worker->lock);
+	bool idle = worker->completed == worker->requested && !worker->have_results;
+	mtx_unlock(&worker->lock);
+	return idle;
+}
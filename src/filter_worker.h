@@ -0,0 +1,68 @@
+#ifndef FILTER_WORKER_H
+#define FILTER_WORKER_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <threads.h>
+#include "string_vec.h"
+
+/*
+ * A single background thread which runs searches, so that the main thread
+ * can keep handling Wayland events and redrawing while a slow one is in
+ * progress.
+ *
+ * Only the latest request matters: making a new request cancels any search
+ * that's still running, and results are only kept for the latest request.
+ * When they're ready, event_fd becomes readable, so that it can be polled
+ * along with everything else in the main loop.
+ *
+ * A zero-initialised worker isn't running, and won't accept requests.
+ */
+struct filter_worker {
+	thrd_t thread;
+	mtx_t lock;
+	cnd_t work_ready;
+	cnd_t work_done;
+	int event_fd;
+	bool running;
+
+	/*
+	 * The search function, which should stop early if cancel becomes set,
+	 * in which case its results will just be thrown away.
+	 */
+	struct string_ref_vec (*func)(
+			void *arg,
+			const char *text,
+			const atomic_bool *cancel);
+	void *arg;
+
+	/* Everything below is protected by lock. */
+	char *text;
+	uint64_t requested;
+	uint64_t completed;
+	struct string_ref_vec results;
+	bool have_results;
+	atomic_bool cancel;
+	bool quit;
+};
+
+bool filter_worker_init(
+		struct filter_worker *worker,
+		struct string_ref_vec (*func)(
+			void *arg,
+			const char *text,
+			const atomic_bool *cancel),
+		void *arg);
+void filter_worker_destroy(struct filter_worker *worker);
+
+bool filter_worker_request(struct filter_worker *worker, const char *text);
+bool filter_worker_collect(
+		struct filter_worker *worker,
+		struct string_ref_vec *results);
+bool filter_worker_wait(
+		struct filter_worker *worker,
+		struct string_ref_vec *results);
+bool filter_worker_idle(struct filter_worker *worker);
+
+#endif /* FILTER_WORKER_H */
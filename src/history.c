@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include "arena.h"
 #include "history.h"
 #include "log.h"
 #include "mkdirp.h"
@@ -175,10 +176,8 @@ struct history history_create(void)
 
 void history_destroy(struct history *restrict vec)
 {
-	for (size_t i = 0; i < vec->count; i++) {
-		free(vec->buf[i].name);
-	}
 	free(vec->buf);
+	arena_destroy(&vec->names);
 }
 
 void history_add(struct history *restrict vec, const char *restrict str)
@@ -211,7 +210,7 @@ void history_add(struct history *restrict vec, const char *restrict str)
 		vec->size *= 2;
 		vec->buf = xrealloc(vec->buf, vec->size * sizeof(vec->buf[0]));
 	}
-	vec->buf[vec->count].name = xstrdup(str);
+	vec->buf[vec->count].name = arena_strdup(&vec->names, str);
 	vec->buf[vec->count].run_count = 1;
 	vec->count++;
 }
@@ -220,7 +219,7 @@ void history_remove(struct history *restrict vec, const char *restrict str)
 {
 	for (size_t i = 0; i < vec->count; i++) {
 		if (!strcmp(vec->buf[i].name, str)) {
-			free(vec->buf[i].name);
+			/* The name itself stays in the arena. */
 			if (i < vec->count - 1) {
 				memmove(&vec->buf[i], &vec->buf[i+1], (vec->count - i) * sizeof(struct program));
 			}
@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include "arena.h"
 
 struct program {
 	char *restrict name;
@@ -13,6 +14,8 @@ struct history {
 	size_t count;
 	size_t size;
 	struct program *buf;
+	/* Storage for the names of the programs. */
+	struct arena names;
 };
 
 [[gnu::nonnull]]
@@ -5,7 +5,9 @@
 #include "input.h"
 #include "log.h"
 #include "nelem.h"
+#include "result_cache.h"
 #include "tofi.h"
+#include "trigram_index.h"
 #include "unicode.h"
 
 
@@ -22,6 +24,10 @@ static void select_next_page(struct tofi *tofi);
 static void next_cursor_or_result(struct tofi *tofi);
 static void previous_cursor_or_result(struct tofi *tofi);
 static void reset_selection(struct tofi *tofi);
+static struct string_ref_vec filter(
+		struct tofi *tofi,
+		const struct string_ref_vec *vec,
+		const struct match_query *query);
 
 void input_handle_keypress(struct tofi *tofi, xkb_keycode_t keycode)
 {
@@ -102,10 +108,6 @@ void input_handle_keypress(struct tofi *tofi, xkb_keycode_t keycode)
 		return;
 	}
 
-	if (tofi->auto_accept_single && tofi->window.entry.results.count == 1) {
-		tofi->submit = true;
-	}
-
 	tofi->window.surface.redraw = true;
 }
 
@@ -183,45 +185,33 @@ void add_character(struct tofi *tofi, xkb_keycode_t keycode)
 	}
 
 	char buf[5]; /* 4 UTF-8 bytes plus null terminator. */
-	int len = xkb_state_key_get_utf8(
+	xkb_state_key_get_utf8(
 			tofi->xkb_state,
 			keycode,
 			buf,
 			sizeof(buf));
-	if (entry->cursor_position == entry->input_utf32_length) {
-		entry->input_utf32[entry->input_utf32_length] = utf8_to_utf32(buf);
-		entry->input_utf32_length++;
-		entry->input_utf32[entry->input_utf32_length] = U'\0';
-		memcpy(&entry->input_utf8[entry->input_utf8_length],
-				buf,
-				N_ELEM(buf));
-		entry->input_utf8_length += len;
-
-		if (entry->mode == TOFI_MODE_DRUN) {
-			struct string_ref_vec results = desktop_vec_filter(&entry->apps, entry->input_utf8, tofi->matching_algorithm);
-			string_ref_vec_destroy(&entry->results);
-			entry->results = results;
-		} else {
-			struct string_ref_vec tmp = entry->results;
-			entry->results = string_ref_vec_filter(&entry->results, entry->input_utf8, tofi->matching_algorithm);
-			string_ref_vec_destroy(&tmp);
-		}
-
-		reset_selection(tofi);
-	} else {
-		for (size_t i = entry->input_utf32_length; i > entry->cursor_position; i--) {
-			entry->input_utf32[i] = entry->input_utf32[i - 1];
-		}
-		entry->input_utf32[entry->cursor_position] = utf8_to_utf32(buf);
-		entry->input_utf32_length++;
-		entry->input_utf32[entry->input_utf32_length] = U'\0';
-
-		input_refresh_results(tofi);
+	for (size_t i = entry->input_utf32_length; i > entry->cursor_position; i--) {
+		entry->input_utf32[i] = entry->input_utf32[i - 1];
 	}
-
+	entry->input_utf32[entry->cursor_position] = utf8_to_utf32(buf);
+	entry->input_utf32_length++;
+	entry->input_utf32[entry->input_utf32_length] = U'\0';
 	entry->cursor_position++;
+
+	/*
+	 * There's no need for a special case for adding to the end of the
+	 * input, as the previous results will be in the cache, and will be
+	 * filtered instead of everything.
+	 */
+	tofi->input_changed = true;
 }
 
+/*
+ * Start a search for the current input. Editing the input just sets
+ * tofi->input_changed, and the main loop calls this once per iteration
+ * if needed, so that a burst of typing, key repeats or pasting only
+ * results in one search.
+ */
 void input_refresh_results(struct tofi *tofi)
 {
 	struct entry *entry = &tofi->window.entry;
@@ -234,14 +224,150 @@ void input_refresh_results(struct tofi *tofi)
 	}
 	entry->input_utf8[bytes_written] = '\0';
 	entry->input_utf8_length = bytes_written;
+
+	match_query_destroy(&entry->query);
+	entry->query = match_query_create(
+			tofi->matching_algorithm,
+			entry->input_utf8);
+
+	/*
+	 * Searching is normally done in the background, and the current
+	 * results stay on screen until the new ones arrive (see
+	 * input_set_results()). If the worker hasn't been started yet, just
+	 * search here instead.
+	 */
+	if (filter_worker_request(&tofi->filter_worker, entry->input_utf8)) {
+		return;
+	}
+	input_set_results(tofi, input_search(tofi, entry->input_utf8, NULL));
+}
+
+/*
+ * Replace the displayed results with the results of a search.
+ */
+void input_set_results(struct tofi *tofi, struct string_ref_vec results)
+{
+	struct entry *entry = &tofi->window.entry;
 	string_ref_vec_destroy(&entry->results);
+	entry->results = results;
+	reset_selection(tofi);
+
+	/* Streamed input isn't complete yet, so wait until it is. */
+	if (tofi->auto_accept_single
+			&& !tofi->stream.open
+			&& entry->results.count == 1) {
+		tofi->submit = true;
+	}
+	tofi->window.surface.redraw = true;
+}
+
+/*
+ * Find the results for text, where arg is the struct tofi. This is run on the
+ * filter worker's thread once that's started, so must only touch the parts
+ * of tofi that the main thread then leaves alone: the (read-only) lists of
+ * commands and apps, the result cache and the worker pool.
+ */
+struct string_ref_vec input_search(
+		void *arg,
+		const char *text,
+		const atomic_bool *cancel)
+{
+	struct tofi *tofi = arg;
+	struct entry *entry = &tofi->window.entry;
+
+	/* If we've seen this exact input before, we already know the results. */
+	struct string_ref_vec *cached = result_cache_find(
+			&entry->result_cache,
+			text);
+	if (cached != NULL) {
+		return string_ref_vec_share(cached);
+	}
+
+	struct match_query query = match_query_create(
+			tofi->matching_algorithm,
+			text);
+	query.cancel = cancel;
+	/*
+	 * If a previous search is guaranteed to have found everything this
+	 * one will, just filter its results.
+	 */
+	const struct string_ref_vec *parent = result_cache_find_parent(
+			&entry->result_cache,
+			&query);
+	struct string_ref_vec results;
 	if (entry->mode == TOFI_MODE_DRUN) {
-		entry->results = desktop_vec_filter(&entry->apps, entry->input_utf8, tofi->matching_algorithm);
+		if (parent == NULL) {
+			results = desktop_vec_filter(&entry->apps, &query);
+		} else {
+			results = desktop_vec_filter_results(&entry->apps, parent, &query);
+		}
 	} else {
-		entry->results = string_ref_vec_filter(&entry->commands, entry->input_utf8, tofi->matching_algorithm);
+		/*
+		 * If there's a search index, it can usually narrow things down
+		 * much further than a previous search can, but it's not worth
+		 * asking it if we've already narrowed things down a lot.
+		 */
+		struct string_ref_vec candidates;
+		bool indexed = false;
+		if (parent == NULL || parent->count >= tofi->index_threshold) {
+			indexed = trigram_index_lookup(
+					&tofi->trigram_index,
+					&query,
+					&candidates);
+		}
+		if (indexed && (parent == NULL || candidates.count < parent->count)) {
+			parent = &candidates;
+		} else if (parent == NULL) {
+			parent = &entry->commands;
+		}
+		results = filter(tofi, parent, &query);
+		if (indexed) {
+			string_ref_vec_destroy(&candidates);
+		}
 	}
 
-	reset_selection(tofi);
+	/*
+	 * Empty queries match everything, so caching them would just hold on
+	 * to a reference to every entry in the list. Cancelled searches may
+	 * not have finished, so their results can't be trusted.
+	 */
+	if (query.count > 0 && !match_query_cancelled(&query)) {
+		result_cache_add(
+				&entry->result_cache,
+				tofi->matching_algorithm,
+				text,
+				&results);
+	}
+	match_query_destroy(&query);
+
+	return results;
+}
+
+/*
+ * Filter vec, using multiple threads if it's long enough to be worth it.
+ * The worker threads are only started the first time they're needed, and if
+ * that fails, everything is just filtered on this thread instead.
+ */
+struct string_ref_vec filter(
+		struct tofi *tofi,
+		const struct string_ref_vec *vec,
+		const struct match_query *query)
+{
+	size_t num_threads = tofi->filter_threads;
+	if (num_threads == 0) {
+		long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		num_threads = num_cpus > 0 ? num_cpus : 1;
+	}
+	if (num_threads <= 1 || vec->count < tofi->filter_threshold) {
+		return string_ref_vec_filter(vec, query);
+	}
+	if (tofi->worker_pool.threads == NULL && !tofi->worker_pool.failed) {
+		worker_pool_init(&tofi->worker_pool, num_threads - 1);
+	}
+	if (tofi->worker_pool.failed) {
+		return string_ref_vec_filter(vec, query);
+	}
+	return string_ref_vec_filter_parallel(vec, query, &tofi->worker_pool);
 }
 
 void delete_character(struct tofi *tofi)
@@ -268,7 +394,7 @@ void delete_character(struct tofi *tofi)
 		entry->input_utf32[entry->input_utf32_length] = U'\0';
 	}
 
-	input_refresh_results(tofi);
+	tofi->input_changed = true;
 }
 
 void delete_word(struct tofi *tofi)
@@ -295,7 +421,7 @@ void delete_word(struct tofi *tofi)
 	entry->input_utf32[entry->input_utf32_length] = U'\0';
 
 	entry->cursor_position = new_cursor_pos;
-	input_refresh_results(tofi);
+	tofi->input_changed = true;
 }
 
 void clear_input(struct tofi *tofi)
@@ -306,7 +432,7 @@ void clear_input(struct tofi *tofi)
 	entry->input_utf32_length = 0;
 	entry->input_utf32[0] = U'\0';
 
-	input_refresh_results(tofi);
+	tofi->input_changed = true;
 }
 
 void paste(struct tofi *tofi)
@@ -1,10 +1,16 @@
 #ifndef INPUT_H
 #define INPUT_H
 
+#include <stdatomic.h>
 #include <xkbcommon/xkbcommon.h>
 #include "tofi.h"
 
 void input_handle_keypress(struct tofi *tofi, xkb_keycode_t keycode);
 void input_refresh_results(struct tofi *tofi);
+void input_set_results(struct tofi *tofi, struct string_ref_vec results);
+struct string_ref_vec input_search(
+		void *arg,
+		const char *text,
+		const atomic_bool *cancel);
 
 #endif /* INPUT_H */
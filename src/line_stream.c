@@ -0,0 +1,145 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "line_stream.h"
+#include "log.h"
+#include "xmalloc.h"
+
+/* How much to try to read at once, which is the default size of a pipe. */
+#define READ_SIZE 65536
+
+#undef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+/*
+ * Start reading lines separated by delimiter from fd, which is switched to
+ * non-blocking mode.
+ */
+bool line_stream_open(struct line_stream *stream, int fd, char delimiter)
+{
+	*stream = (struct line_stream){
+		.fd = fd,
+		.delimiter = delimiter
+	};
+	stream->flags = fcntl(fd, F_GETFL);
+	if (stream->flags == -1
+			|| fcntl(fd, F_SETFL, stream->flags | O_NONBLOCK) == -1) {
+		log_error("Failed to make input non-blocking: %s\n", strerror(errno));
+		return false;
+	}
+	stream->open = true;
+	return true;
+}
+
+/*
+ * Stop reading. The file descriptor itself is left open, as it was before.
+ */
+void line_stream_close(struct line_stream *stream)
+{
+	if (stream->open) {
+		fcntl(stream->fd, F_SETFL, stream->flags);
+	}
+	free(stream->buf);
+	*stream = (struct line_stream){ 0 };
+}
+
+/*
+ * Read whatever's available without blocking. This should be called when fd
+ * is readable, or has been hung up.
+ */
+void line_stream_read(struct line_stream *stream)
+{
+	if (!stream->open || stream->eof) {
+		return;
+	}
+
+	/* Make room for a full read after whatever's left over. */
+	if (stream->start > 0) {
+		memmove(stream->buf, &stream->buf[stream->start], stream->len);
+		stream->start = 0;
+	}
+	if (stream->size - stream->len < READ_SIZE) {
+		stream->size = MAX(2 * stream->size, stream->len + READ_SIZE);
+		stream->buf = xrealloc(stream->buf, stream->size);
+	}
+
+	errno = 0;
+	ssize_t bytes_read = read(
+			stream->fd,
+			&stream->buf[stream->len],
+			stream->size - stream->len);
+	if (bytes_read == -1) {
+		if (errno == EAGAIN || errno == EINTR) {
+			return;
+		}
+		log_error("Error reading input: %s\n", strerror(errno));
+		bytes_read = 0;
+	}
+	if (bytes_read == 0) {
+		stream->eof = true;
+		return;
+	}
+
+	const char *p = &stream->buf[stream->len];
+	const char *end = p + bytes_read;
+	while ((p = memchr(p, stream->delimiter, end - p)) != NULL) {
+		stream->num_lines++;
+		p++;
+	}
+	stream->len += bytes_read;
+}
+
+/*
+ * Return true if there's anything ready for line_stream_take(). A final line
+ * without a trailing newline only counts once the end of the input has been
+ * reached.
+ */
+bool line_stream_pending(const struct line_stream *stream)
+{
+	return stream->num_lines > 0 || (stream->eof && stream->len > 0);
+}
+
+/*
+ * Return true once everything has been read and handed out.
+ */
+bool line_stream_finished(const struct line_stream *stream)
+{
+	return !stream->open || (stream->eof && stream->len == 0);
+}
+
+/*
+ * Take up to max_lines (or all, if max_lines is 0) of the complete lines
+ * that have been read, as a newly allocated, nul-terminated buffer, setting
+ * *len to its length. Returns NULL if there aren't any.
+ */
+char *line_stream_take(struct line_stream *stream, size_t max_lines, size_t *len)
+{
+	if (!line_stream_pending(stream)) {
+		return NULL;
+	}
+
+	char *start = &stream->buf[stream->start];
+	char *p = start;
+	size_t num_lines = 0;
+	while (num_lines < stream->num_lines
+			&& (max_lines == 0 || num_lines < max_lines)) {
+		p = memchr(p, stream->delimiter, stream->len - (p - start));
+		p++;
+		num_lines++;
+	}
+	*len = p - start;
+	if (stream->eof && num_lines == stream->num_lines) {
+		/* Include the final line, even if it isn't terminated. */
+		*len = stream->len;
+	}
+
+	char *lines = xmalloc(*len + 1);
+	memcpy(lines, start, *len);
+	lines[*len] = '\0';
+	stream->start += *len;
+	stream->len -= *len;
+	stream->num_lines -= num_lines;
+	return lines;
+}
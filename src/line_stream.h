@@ -0,0 +1,40 @@
+#ifndef LINE_STREAM_H
+#define LINE_STREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Non-blocking reader for a stream of lines, such as stdin, which hands them
+ * out in batches as they arrive.
+ *
+ * Lines are separated by delimiter. Data is read into buf, of which the bytes
+ * from start to start + len haven't been handed out yet. num_lines is how
+ * many complete lines that includes. flags are the file status flags of fd before it was
+ * opened, which are restored when it's closed.
+ *
+ * A zero-initialised stream isn't open.
+ */
+struct line_stream {
+	int fd;
+	int flags;
+	char *buf;
+	size_t size;
+	size_t start;
+	size_t len;
+	size_t num_lines;
+	char delimiter;
+	bool eof;
+	bool open;
+};
+
+bool line_stream_open(struct line_stream *stream, int fd, char delimiter);
+void line_stream_close(struct line_stream *stream);
+void line_stream_read(struct line_stream *stream);
+bool line_stream_pending(const struct line_stream *stream);
+bool line_stream_finished(const struct line_stream *stream);
+
+[[nodiscard("memory leaked")]]
+char *line_stream_take(struct line_stream *stream, size_t max_lines, size_t *len);
+
+#endif /* LINE_STREAM_H */
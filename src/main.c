@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <getopt.h>
+#include <inttypes.h>
 #include <locale.h>
 #include <poll.h>
 #include <stdbool.h>
@@ -8,6 +9,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <threads.h>
 #include <unistd.h>
 #include <wayland-client.h>
@@ -22,6 +24,7 @@
 #include "log.h"
 #include "nelem.h"
 #include "lock.h"
+#include "result_cache.h"
 #include "scale.h"
 #include "shm.h"
 #include "string_vec.h"
@@ -48,8 +51,12 @@ static uint32_t gettime_ms() {
 }
 
 
-/* Read all of stdin into a buffer. */
-static char *read_stdin(bool normalize) {
+/*
+ * Read all of stdin into a nul-terminated buffer, a block at a time, setting
+ * *len to the number of bytes read.
+ */
+static char *read_stdin_blocks(size_t *len)
+{
 	const size_t block_size = BUFSIZ;
 	size_t num_blocks = 1;
 	size_t buf_size = block_size;
@@ -69,18 +76,92 @@ static char *read_stdin(bool normalize) {
 			if (!feof(stdin) && ferror(stdin)) {
 				log_error("Error reading stdin.\n");
 			}
-			buf[block * block_size + bytes_read] = '\0';
+			*len = block * block_size + bytes_read;
+			buf[*len] = '\0';
 			break;
 		}
 	}
-	if (normalize) {
-		if (utf8_validate(buf)) {
-			char *tmp = utf8_normalize(buf);
-			free(buf);
-			buf = tmp;
-		} else {
-			log_error("Invalid UTF-8 in stdin.\n");
-		}
+	return buf;
+}
+
+static bool stdin_is_file(void)
+{
+	struct stat st;
+	return fstat(STDIN_FILENO, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+/*
+ * If stdin is a regular file, map it into memory rather than reading it,
+ * which for a large file is much faster, as it isn't copied through stdio
+ * into a buffer that has to keep growing. Returns NULL if this isn't
+ * possible, otherwise setting *len to the length of the file, and *mapped to
+ * the length of the mapping.
+ */
+static char *map_stdin(size_t *len, size_t *mapped)
+{
+	struct stat st;
+	if (fstat(STDIN_FILENO, &st) == -1
+			|| !S_ISREG(st.st_mode)
+			|| st.st_size == 0
+			|| lseek(STDIN_FILENO, 0, SEEK_CUR) != 0) {
+		return NULL;
+	}
+
+	/*
+	 * Lines are terminated in place, so the mapping has to be private
+	 * and writable, which means each page is copied the first time it's
+	 * written to. It also needs one more byte than the file for the final
+	 * terminator, so the file is mapped over the start of some (zeroed)
+	 * anonymous memory.
+	 */
+	*len = st.st_size;
+	char *buf = mmap(
+			NULL,
+			*len + 1,
+			PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS,
+			-1,
+			0);
+	if (buf == MAP_FAILED) {
+		return NULL;
+	}
+	if (mmap(buf,
+			*len,
+			PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_FIXED,
+			STDIN_FILENO,
+			0) == MAP_FAILED) {
+		log_debug("Failed to map stdin: %s\n", strerror(errno));
+		munmap(buf, *len + 1);
+		return NULL;
+	}
+	*mapped = *len + 1;
+	return buf;
+}
+
+static void free_stdin(char *buf, size_t mapped)
+{
+	if (mapped > 0) {
+		munmap(buf, mapped);
+	} else {
+		free(buf);
+	}
+}
+
+/*
+ * Read all of stdin into a nul-terminated buffer, which should be freed with
+ * free_stdin(), setting *len to its length. If it was mapped rather than read
+ * (see map_stdin()), *mapped is set to the length of the mapping, otherwise
+ * it's set to 0.
+ *
+ * This doesn't check or normalize the input, which is done line by line by
+ * string_ref_vec_from_buffer().
+ */
+static char *read_stdin(size_t *len, size_t *mapped) {
+	char *buf = map_stdin(len, mapped);
+	if (buf == NULL) {
+		*mapped = 0;
+		buf = read_stdin_blocks(len);
 	}
 	return buf;
 }
@@ -915,15 +996,31 @@ const struct option long_options[] = {
 	{"require-match", required_argument, NULL, 0},
 	{"auto-accept-single", required_argument, NULL, 0},
 	{"print-index", required_argument, NULL, 0},
+	{"delimiter", required_argument, NULL, 0},
+	{"read0", required_argument, NULL, 0},
+	{"print0", required_argument, NULL, 0},
+	{"dedup", required_argument, NULL, 0},
+	{"dedup-count", required_argument, NULL, 0},
 	{"hide-input", required_argument, NULL, 0},
 	{"hidden-character", required_argument, NULL, 0},
 	{"physical-keybindings", required_argument, NULL, 0},
 	{"drun-launch", required_argument, NULL, 0},
 	{"drun-print-exec", required_argument, NULL, 0},
+	{"drun-name-weight", required_argument, NULL, 0},
+	{"drun-generic-name-weight", required_argument, NULL, 0},
+	{"drun-keywords-weight", required_argument, NULL, 0},
+	{"drun-exec-weight", required_argument, NULL, 0},
+	{"drun-comment-weight", required_argument, NULL, 0},
 	{"terminal", required_argument, NULL, 0},
 	{"hint-font", required_argument, NULL, 0},
 	{"multi-instance", required_argument, NULL, 0},
 	{"ascii-input", required_argument, NULL, 0},
+	{"filter-threads", required_argument, NULL, 0},
+	{"filter-threshold", required_argument, NULL, 0},
+	{"index-threshold", required_argument, NULL, 0},
+	{"stream-input", required_argument, NULL, 0},
+	{"stream-batch-size", required_argument, NULL, 0},
+	{"stream-redraw-rate", required_argument, NULL, 0},
 	{"output", required_argument, NULL, 0},
 	{"scale", required_argument, NULL, 0},
 	{"late-keyboard-init", optional_argument, NULL, 'k'},
@@ -1005,34 +1102,21 @@ static bool do_submit(struct tofi *tofi)
 	struct entry *entry = &tofi->window.entry;
 	uint32_t selection = entry->selection + entry->first_result;
 	char *res = entry->results.buf[selection].string;
+	char end = tofi->print0 ? '\0' : tofi->delimiter;
 
 	if (tofi->window.entry.results.count == 0) {
 		/* Always require a match in drun mode. */
 		if (tofi->require_match || entry->mode == TOFI_MODE_DRUN) {
 			return false;
 		} else {
-			printf("%s\n", entry->input_utf8);
+			printf("%s%c", entry->input_utf8, end);
 			return true;
 		}
 	}
 
 	if (entry->mode == TOFI_MODE_DRUN) {
-		/*
-		 * At this point, the list of apps is history sorted rather
-		 * than alphabetically sorted, so we can't use
-		 * desktop_vec_find_sorted().
-		 */
-		struct desktop_entry *app = NULL;
-		for (size_t i = 0; i < entry->apps.count; i++) {
-			if (!strcmp(res, entry->apps.buf[i].name)) {
-				app = &entry->apps.buf[i];
-				break;
-			}
-		}
-		if (app == NULL) {
-			log_error("Couldn't find application file! This shouldn't happen.\n");
-			return false;
-		}
+		/* Each result knows which app it came from. */
+		struct desktop_entry *app = &entry->apps.buf[entry->results.buf[selection].index];
 		char *path = app->path;
 		if (tofi->drun_launch) {
 			drun_launch(path);
@@ -1041,14 +1125,9 @@ static bool do_submit(struct tofi *tofi)
 		}
 	} else {
 		if (entry->mode == TOFI_MODE_PLAIN && tofi->print_index) {
-			for (size_t i = 0; i < entry->commands.count; i++) {
-				if (res == entry->commands.buf[i].string) {
-					printf("%zu\n", i + 1);
-					break;
-				}
-			}
+			printf("%" PRIu32 "%c", entry->results.buf[selection].index + 1, end);
 		} else {
-			printf("%s\n", res);
+			printf("%s%c", res, end);
 		}
 	}
 	if (tofi->use_history) {
@@ -1064,6 +1143,105 @@ static bool do_submit(struct tofi *tofi)
 	return true;
 }
 
+/*
+ * Start indexing the list of commands in the background, if it's long enough
+ * to be worth it. The list mustn't change after this.
+ */
+static void start_index(struct tofi *tofi)
+{
+	if (tofi->window.entry.mode != TOFI_MODE_DRUN
+			&& tofi->matching_algorithm != MATCHING_ALGORITHM_FUZZY
+			&& tofi->matching_algorithm != MATCHING_ALGORITHM_TYPO
+			&& tofi->index_threshold > 0
+			&& tofi->window.entry.commands.count >= tofi->index_threshold) {
+		log_debug("Building search index in the background.\n");
+		trigram_index_start(&tofi->trigram_index, &tofi->window.entry.commands);
+	}
+}
+
+/*
+ * Called once all of a streamed stdin has been read, to do everything that
+ * would have been done at startup if we'd waited for it.
+ */
+static void finish_stream(struct tofi *tofi)
+{
+	struct entry *entry = &tofi->window.entry;
+	line_stream_close(&tofi->stream);
+	line_set_count_duplicates(&tofi->stream_unique, &entry->commands);
+	line_set_destroy(&tofi->stream_unique);
+	log_debug("Finished reading stdin, %zu lines.\n", entry->commands.count);
+
+	if (tofi->use_history || (tofi->dedup && tofi->dedup_count)) {
+		/*
+		 * This changes the order of the list and the scores of its
+		 * entries, so anything already found has to be searched for
+		 * again.
+		 */
+		string_ref_vec_history_sort(&entry->commands, &entry->history);
+		result_cache_clear(&entry->result_cache);
+		tofi->input_changed = true;
+	} else if (tofi->auto_accept_single && entry->results.count == 1) {
+		tofi->submit = true;
+	}
+	start_index(tofi);
+	tofi->window.surface.redraw = true;
+}
+
+/*
+ * Add the next batch of lines from a streamed stdin to the list of commands,
+ * and to the current results if they match.
+ */
+static void read_stream(struct tofi *tofi)
+{
+	struct entry *entry = &tofi->window.entry;
+
+	/*
+	 * The filter worker reads the list while it's searching, so it can
+	 * only be added to in between searches. This also means the current
+	 * results are those of the current query.
+	 */
+	if (!filter_worker_idle(&tofi->filter_worker)) {
+		return;
+	}
+
+	if (!line_stream_pending(&tofi->stream)) {
+		line_stream_read(&tofi->stream);
+	}
+	size_t len;
+	char *lines = line_stream_take(&tofi->stream, tofi->stream_batch_size, &len);
+	if (lines != NULL) {
+		size_t start = entry->commands.count;
+		string_ref_vec_append_buffer(
+				&entry->commands,
+				lines,
+				len,
+				tofi->stream.delimiter,
+				!tofi->ascii_input,
+				tofi->dedup ? &tofi->stream_unique : NULL);
+		struct string_ref_vec added = {
+			.count = entry->commands.count - start,
+			.size = entry->commands.count - start,
+			.buf = &entry->commands.buf[start],
+			.sorted = SIZE_MAX,
+			.masks = &entry->commands.masks[start]
+		};
+
+		/*
+		 * Rather than searching everything again, just search the new
+		 * lines, and add any matches to the existing results.
+		 */
+		result_cache_extend(&entry->result_cache, &added);
+		struct string_ref_vec matches = string_ref_vec_filter(&added, &entry->query);
+		string_ref_vec_merge(&entry->results, &matches);
+		string_ref_vec_destroy(&matches);
+		tofi->stream_redraw = true;
+	}
+
+	if (line_stream_finished(&tofi->stream)) {
+		finish_stream(tofi);
+	}
+}
+
 static void read_clipboard(struct tofi *tofi)
 {
 	struct entry *entry = &tofi->window.entry;
@@ -1104,7 +1282,7 @@ static void read_clipboard(struct tofi *tofi)
 					 * a character, but we should hit the
 					 * input length limit long before that.
 					 */
-					input_refresh_results(tofi);
+					tofi->input_changed = true;
 					tofi->window.surface.redraw = true;
 					return;
 				}
@@ -1147,7 +1325,7 @@ static void read_clipboard(struct tofi *tofi)
 
 	clipboard_finish_paste(&tofi->clipboard);
 
-	input_refresh_results(tofi);
+	tofi->input_changed = true;
 	tofi->window.surface.redraw = true;
 }
 
@@ -1198,8 +1376,20 @@ int main(int argc, char *argv[])
 			| ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT,
 		.use_history = true,
 		.require_match = true,
+		.delimiter = '\n',
 		.use_scale = true,
 		.physical_keybindings = true,
+		.drun_weights = {
+			[DESKTOP_FIELD_NAME] = 0,
+			[DESKTOP_FIELD_GENERIC_NAME] = -10,
+			[DESKTOP_FIELD_KEYWORDS] = -20,
+			[DESKTOP_FIELD_EXEC] = -20,
+			[DESKTOP_FIELD_COMMENT] = -40
+		},
+		.filter_threshold = 50000,
+		.index_threshold = 1000000,
+		.stream_batch_size = 1000,
+		.stream_redraw_rate = 30,
 	};
 	wl_list_init(&tofi.output_list);
 	if (getenv("TERMINAL") != NULL) {
@@ -1458,7 +1648,12 @@ int main(int argc, char *argv[])
 		log_indent();
 		tofi.window.entry.mode = TOFI_MODE_RUN;
 		tofi.window.entry.command_buffer = compgen_cached();
-		struct string_ref_vec commands = string_ref_vec_from_buffer(tofi.window.entry.command_buffer);
+		struct string_ref_vec commands = string_ref_vec_from_buffer(
+				tofi.window.entry.command_buffer,
+				strlen(tofi.window.entry.command_buffer),
+				'\n',
+				false,
+				NULL);
 		if (tofi.use_history) {
 			if (tofi.history_file[0] == 0) {
 				tofi.window.entry.history = history_load_default_file(false);
@@ -1477,6 +1672,7 @@ int main(int argc, char *argv[])
 		log_indent();
 		tofi.window.entry.mode = TOFI_MODE_DRUN;
 		struct desktop_vec apps = drun_generate_cached();
+		memcpy(apps.weights, tofi.drun_weights, sizeof(apps.weights));
 		if (tofi.use_history) {
 			if (tofi.history_file[0] == 0) {
 				tofi.window.entry.history = history_load_default_file(true);
@@ -1487,25 +1683,65 @@ int main(int argc, char *argv[])
 		}
 		struct string_ref_vec commands = string_ref_vec_create();
 		for (size_t i = 0; i < apps.count; i++) {
-			string_ref_vec_add(&commands, apps.buf[i].name);
+			const struct desktop_field *name = &apps.buf[i].fields[DESKTOP_FIELD_NAME];
+			string_ref_vec_add(&commands, name->str);
+			commands.buf[i].folded = name->folded;
+			commands.buf[i].mask = name->mask;
+			commands.buf[i].initials = apps.buf[i].initials;
+			commands.buf[i].ascii = name->ascii;
 		}
 		tofi.window.entry.commands = commands;
 		tofi.window.entry.apps = apps;
 		log_unindent();
 		log_debug("App list generated.\n");
 	} else {
-		log_debug("Reading stdin.\n");
-		char *buf = read_stdin(!tofi.ascii_input);
-		tofi.window.entry.command_buffer = buf;
-		tofi.window.entry.commands = string_ref_vec_from_buffer(buf);
+		/*
+		 * When streaming, the window is shown straight away, and lines
+		 * are added to the list in the main loop as they arrive.
+		 */
+		char delimiter = tofi.read0 ? '\0' : tofi.delimiter;
+		tofi.stream_unique.count_duplicates = tofi.dedup_count;
+		if (tofi.stream_input
+				&& !stdin_is_file()
+				&& line_stream_open(&tofi.stream, STDIN_FILENO, delimiter)) {
+			log_debug("Streaming stdin.\n");
+			tofi.window.entry.commands = string_ref_vec_create();
+		} else {
+			log_debug("Reading stdin.\n");
+			size_t len;
+			char *buf = read_stdin(
+					&len,
+					&tofi.window.entry.command_buffer_mapped);
+			tofi.window.entry.command_buffer = buf;
+			tofi.window.entry.commands = string_ref_vec_from_buffer(
+					buf,
+					len,
+					delimiter,
+					!tofi.ascii_input,
+					tofi.dedup ? &tofi.stream_unique : NULL);
+			line_set_count_duplicates(
+					&tofi.stream_unique,
+					&tofi.window.entry.commands);
+			line_set_destroy(&tofi.stream_unique);
+		}
 		if (tofi.use_history) {
 			if (tofi.history_file[0] == 0) {
 				tofi.use_history = false;
 			} else {
 				tofi.window.entry.history = history_load(tofi.history_file);
-				string_ref_vec_history_sort(&tofi.window.entry.commands, &tofi.window.entry.history);
+				/* Streamed input is sorted once it's all been read. */
+				if (!tofi.stream.open) {
+					string_ref_vec_history_sort(&tofi.window.entry.commands, &tofi.window.entry.history);
+				}
 			}
 		}
+		if (!tofi.use_history
+				&& tofi.dedup
+				&& tofi.dedup_count
+				&& !tofi.stream.open) {
+			/* Put the most frequent lines first. */
+			string_ref_vec_history_sort(&tofi.window.entry.commands, &tofi.window.entry.history);
+		}
 		log_debug("Result list generated.\n");
 	}
 	tofi.window.entry.results = string_ref_vec_copy(&tofi.window.entry.commands);
@@ -1516,6 +1752,12 @@ int main(int argc, char *argv[])
 		return EXIT_SUCCESS;
 	}
 
+	/*
+	 * Start indexing very long lists, which can carry on in the
+	 * background while we get the window on screen.
+	 */
+	start_index(&tofi);
+
 	/*
 	 * Next, we create the Wayland surface, which takes on the
 	 * layer shell role.
@@ -1745,13 +1987,20 @@ int main(int argc, char *argv[])
 		log_debug("Keyboard configured.\n");
 	}
 
+	/*
+	 * From now on, searches happen in the background, so that a slow one
+	 * can't hold up the main loop. If the worker can't be started, we
+	 * just carry on searching on the main thread.
+	 */
+	filter_worker_init(&tofi.filter_worker, input_search, &tofi);
+
 	/*
 	 * Main event loop.
 	 * See the wl_display(3) man page for an explanation of the
 	 * order of the various functions called here.
 	 */
 	while (!tofi.closed) {
-		struct pollfd pollfds[2] = {{0}, {0}};
+		struct pollfd pollfds[4] = {{0}, {0}, {0}, {0}};
 		pollfds[0].fd = wl_display_get_fd(tofi.wl_display);
 
 		/* Make sure we're ready to receive events on the main queue. */
@@ -1780,32 +2029,50 @@ int main(int argc, char *argv[])
 		}
 
 		pollfds[0].events = POLLIN | POLLPRI;
-		int res;
-		if (tofi.clipboard.fd == 0) {
-			res = poll(&pollfds[0], 1, timeout);
-		} else {
-			/*
-			 * We're trying to paste from the clipboard, which is
-			 * done by reading from a pipe, so poll that file
-			 * descriptor as well.
-			 */
-			pollfds[1].fd = tofi.clipboard.fd;
-			pollfds[1].events = POLLIN | POLLPRI;
-			res = poll(pollfds, 2, timeout);
+
+		/*
+		 * The filter worker tells us when it has new results via an
+		 * eventfd. Negative file descriptors are ignored by poll(),
+		 * so this is harmless if it isn't running.
+		 */
+		pollfds[1].fd = tofi.filter_worker.running ? tofi.filter_worker.event_fd : -1;
+		pollfds[1].events = POLLIN;
+
+		/*
+		 * If we're trying to paste from the clipboard, which is done
+		 * by reading from a pipe, poll that file descriptor as well.
+		 */
+		pollfds[2].fd = tofi.clipboard.fd == 0 ? -1 : tofi.clipboard.fd;
+		pollfds[2].events = POLLIN | POLLPRI;
+
+		/*
+		 * If we're streaming stdin, poll that too, but only in between
+		 * searches (see read_stream()). If we've already read more
+		 * than one batch, carry on straight away, and if there are new
+		 * lines waiting to be drawn, wake up in time to draw them.
+		 */
+		bool stream_ready = tofi.stream.open
+			&& filter_worker_idle(&tofi.filter_worker);
+		pollfds[3].fd = stream_ready ? tofi.stream.fd : -1;
+		pollfds[3].events = POLLIN;
+		if (stream_ready && line_stream_pending(&tofi.stream)) {
+			timeout = 0;
+		}
+		if (tofi.stream_redraw) {
+			int64_t wait = (int64_t)tofi.stream_next_redraw - (int64_t)gettime_ms();
+			wait = MAX(wait, 0);
+			if (timeout == -1 || wait < timeout) {
+				timeout = wait;
+			}
 		}
+
+		int res = poll(pollfds, N_ELEM(pollfds), timeout);
 		if (res == 0) {
 			/*
 			 * No events to process and no error - we presumably
 			 * have a key repeat to handle.
 			 */
 			wl_display_cancel_read(tofi.wl_display);
-			if (tofi.repeat.active) {
-				int64_t wait = (int64_t)tofi.repeat.next - (int64_t)gettime_ms();
-				if (wait <= 0) {
-					input_handle_keypress(&tofi, tofi.repeat.keycode);
-					tofi.repeat.next += 1000 / tofi.repeat.rate;
-				}
-			}
 		} else if (res < 0) {
 			/* There was an error polling the display. */
 			wl_display_cancel_read(tofi.wl_display);
@@ -1816,17 +2083,24 @@ int main(int argc, char *argv[])
 			} else {
 				/*
 				 * No events to read - we were woken up to
-				 * handle clipboard data.
+				 * handle search results or clipboard data.
 				 */
 				wl_display_cancel_read(tofi.wl_display);
 			}
-			if (pollfds[1].revents & (POLLIN | POLLPRI)) {
+			if (pollfds[1].revents & POLLIN) {
+				/* A background search has finished. */
+				struct string_ref_vec results;
+				if (filter_worker_collect(&tofi.filter_worker, &results)) {
+					input_set_results(&tofi, results);
+				}
+			}
+			if (pollfds[2].revents & (POLLIN | POLLPRI)) {
 				/* Read clipboard data. */
 				if (tofi.clipboard.fd > 0) {
 					read_clipboard(&tofi);
 				}
 			}
-			if (pollfds[1].revents & POLLHUP) {
+			if (pollfds[2].revents & POLLHUP) {
 				/*
 				 * The other end of the clipboard pipe has
 				 * closed, cleanup.
@@ -1834,16 +2108,67 @@ int main(int argc, char *argv[])
 				clipboard_finish_paste(&tofi.clipboard);
 			}
 		}
+		if (stream_ready
+				&& ((pollfds[3].revents & (POLLIN | POLLHUP | POLLERR))
+					|| line_stream_pending(&tofi.stream))) {
+			read_stream(&tofi);
+		}
 
 		/* Handle any events we read. */
 		wl_display_dispatch_pending(tofi.wl_display);
 
+		/*
+		 * Handle any key repeats that are due. If we've fallen behind,
+		 * catch up all at once, rather than one per loop, so that we
+		 * don't keep replaying stale repeats after the key is released.
+		 */
+		if (tofi.repeat.active) {
+			uint32_t now = gettime_ms();
+			while (tofi.repeat.active
+					&& !tofi.closed
+					&& !tofi.submit
+					&& (int64_t)tofi.repeat.next - (int64_t)now <= 0) {
+				input_handle_keypress(&tofi, tofi.repeat.keycode);
+				tofi.repeat.next += 1000 / tofi.repeat.rate;
+			}
+		}
+
+		/* Search once for all the input changes since the last loop. */
+		if (tofi.input_changed) {
+			tofi.input_changed = false;
+			input_refresh_results(&tofi);
+		}
+
+		/*
+		 * Redrawing is much slower than adding lines, so only redraw
+		 * for streamed lines every so often.
+		 */
+		if (tofi.stream_redraw) {
+			uint32_t now = gettime_ms();
+			if (tofi.stream_redraw_rate == 0
+					|| (int64_t)tofi.stream_next_redraw - (int64_t)now <= 0) {
+				tofi.window.surface.redraw = true;
+				tofi.stream_redraw = false;
+				if (tofi.stream_redraw_rate > 0) {
+					tofi.stream_next_redraw = now + 1000 / tofi.stream_redraw_rate;
+				}
+			}
+		}
+
 		if (tofi.window.surface.redraw) {
 			entry_update(&tofi.window.entry);
 			surface_draw(&tofi.window.surface);
 			tofi.window.surface.redraw = false;
 		}
 		if (tofi.submit) {
+			/*
+			 * Make sure we submit the results of what was actually
+			 * typed, rather than whatever is currently on screen.
+			 */
+			struct string_ref_vec results;
+			if (filter_worker_wait(&tofi.filter_worker, &results)) {
+				input_set_results(&tofi, results);
+			}
 			tofi.submit = false;
 			if (do_submit(&tofi)) {
 				break;
@@ -1860,6 +2185,9 @@ int main(int argc, char *argv[])
 	 * mostly from Pango, and Cairo holds onto quite a bit of cached data
 	 * (without leaking it)
 	 */
+	filter_worker_destroy(&tofi.filter_worker);
+	trigram_index_destroy(&tofi.trigram_index);
+	line_stream_close(&tofi.stream);
 	surface_destroy(&tofi.window.surface);
 	entry_destroy(&tofi.window.entry);
 	if (tofi.window.wp_viewport != NULL) {
@@ -1906,10 +2234,14 @@ int main(int argc, char *argv[])
 		desktop_vec_destroy(&tofi.window.entry.apps);
 	}
 	if (tofi.window.entry.command_buffer != NULL) {
-		free(tofi.window.entry.command_buffer);
+		free_stdin(
+				tofi.window.entry.command_buffer,
+				tofi.window.entry.command_buffer_mapped);
 	}
 	string_ref_vec_destroy(&tofi.window.entry.commands);
 	string_ref_vec_destroy(&tofi.window.entry.results);
+	result_cache_destroy(&tofi.window.entry.result_cache);
+	worker_pool_destroy(&tofi.worker_pool);
 	if (tofi.use_history) {
 		history_destroy(&tofi.window.entry.history);
 	}
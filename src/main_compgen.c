@@ -1,12 +1,13 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "compgen.h"
 #include "string_vec.h"
 
 int main()
 {
 	char *buf = compgen_cached();
-	struct string_ref_vec commands = string_ref_vec_from_buffer(buf);
+	struct string_ref_vec commands = string_ref_vec_from_buffer(buf, strlen(buf), '\n', false, NULL);
 	for (size_t i = 0; i < commands.count; i++) {
 		fputs(commands.buf[i].string, stdout);
 		fputc('\n', stdout);
@@ -0,0 +1,136 @@
+/*
+ * Generate the lookup tables declared in unicode.h from glib's Unicode data.
+ *
+ * This is run at build time, and writes a C source file to the path given as
+ * its only argument.
+ */
+#include <glib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "unicode.h"
+
+/*
+ * Block indices are stored as bytes, so there can be at most 256 unique
+ * blocks in each table.
+ */
+#define MAX_BLOCKS 256
+
+/*
+ * Split table into blocks, storing the index of each block's first
+ * occurrence in index and the unique blocks themselves in blocks. Returns
+ * the number of unique blocks.
+ */
+static size_t dedup_blocks(
+		const int32_t *table,
+		uint8_t *index,
+		int32_t (*blocks)[UNICODE_BLOCK_SIZE])
+{
+	const size_t block_bytes = UNICODE_BLOCK_SIZE * sizeof(table[0]);
+	size_t count = 0;
+	for (size_t b = 0; b < UNICODE_NUM_BLOCKS; b++) {
+		const int32_t *block = &table[b * UNICODE_BLOCK_SIZE];
+		size_t i;
+		for (i = 0; i < count; i++) {
+			if (memcmp(blocks[i], block, block_bytes) == 0) {
+				break;
+			}
+		}
+		if (i == count) {
+			if (count == MAX_BLOCKS) {
+				fprintf(stderr, "Too many unique blocks.\n");
+				exit(EXIT_FAILURE);
+			}
+			memcpy(blocks[count], block, block_bytes);
+			count++;
+		}
+		index[b] = i;
+	}
+	return count;
+}
+
+static void print_table(
+		FILE *fp,
+		const char *name,
+		const char *type,
+		const uint8_t *index,
+		int32_t (*blocks)[UNICODE_BLOCK_SIZE],
+		size_t count)
+{
+	fprintf(fp, "const uint8_t %s_index[%d] = {", name, UNICODE_NUM_BLOCKS);
+	for (size_t b = 0; b < UNICODE_NUM_BLOCKS; b++) {
+		fprintf(fp, "%s%u,", b % 16 == 0 ? "\n\t" : " ", index[b]);
+	}
+	fprintf(fp, "\n};\n\n");
+
+	fprintf(fp, "const %s %s_blocks[%zu][%d] = {\n", type, name, count, UNICODE_BLOCK_SIZE);
+	for (size_t i = 0; i < count; i++) {
+		fprintf(fp, "\t{");
+		for (size_t j = 0; j < UNICODE_BLOCK_SIZE; j++) {
+			fprintf(fp, "%s%d,", j % 16 == 0 ? "\n\t\t" : " ", blocks[i][j]);
+		}
+		fprintf(fp, "\n\t},\n");
+	}
+	fprintf(fp, "};\n\n");
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s OUTPUT\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	const size_t num_chars = UNICODE_MAX + 1;
+	int32_t *classes = calloc(num_chars, sizeof(*classes));
+	int32_t *lower = calloc(num_chars, sizeof(*lower));
+	uint8_t *index = calloc(UNICODE_NUM_BLOCKS, sizeof(*index));
+	int32_t (*blocks)[UNICODE_BLOCK_SIZE] = calloc(MAX_BLOCKS, sizeof(*blocks));
+	if (classes == NULL || lower == NULL || index == NULL || blocks == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		return EXIT_FAILURE;
+	}
+
+	for (uint32_t c = 0; c < num_chars; c++) {
+		if (g_unichar_isupper(c)) {
+			classes[c] |= UNICODE_CLASS_UPPER;
+		}
+		if (g_unichar_islower(c)) {
+			classes[c] |= UNICODE_CLASS_LOWER;
+		}
+		if (g_unichar_isalnum(c)) {
+			classes[c] |= UNICODE_CLASS_ALNUM;
+		}
+		/* Store the difference, so that most blocks are just zeros. */
+		lower[c] = (int32_t)g_unichar_tolower(c) - (int32_t)c;
+	}
+
+	FILE *fp = fopen(argv[1], "wb");
+	if (fp == NULL) {
+		fprintf(stderr, "Failed to open %s for writing.\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	fprintf(fp, "/* Generated by main_unicode_tables.c, do not edit. */\n\n");
+	/* So that the definitions are checked against their declarations. */
+	fprintf(fp, "#include <stdint.h>\n");
+	fprintf(fp, "#include \"unicode.h\"\n\n");
+
+	size_t count = dedup_blocks(classes, index, blocks);
+	print_table(fp, "unicode_class", "uint8_t", index, blocks, count);
+
+	count = dedup_blocks(lower, index, blocks);
+	print_table(fp, "unicode_lower", "int32_t", index, blocks, count);
+
+	if (fclose(fp) != 0) {
+		fprintf(stderr, "Failed to write %s.\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	free(blocks);
+	free(index);
+	free(lower);
+	free(classes);
+	return EXIT_SUCCESS;
+}
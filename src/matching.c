@@ -1,251 +1,1108 @@
 #include <ctype.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <threads.h>
 
 #include "matching.h"
+#include "simd.h"
 #include "unicode.h"
 #include "xmalloc.h"
 
 #undef MAX
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
+#undef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
 
-static int32_t simple_match_words(
-		const char *restrict patterns,
-		const char *restrict str);
+/*
+ * The longest word that can be matched with typos, so that a bit per
+ * character of it fits in a uint64_t. Longer words must match exactly.
+ */
+#define TYPO_MAX_CHARS 64
 
-static int32_t prefix_match_words(
-		const char *restrict patterns,
-		const char *restrict str);
+/*
+ * The amount each typo in a match costs, which is enough that exact matches
+ * almost always come before ones with typos.
+ */
+#define TYPO_PENALTY 1000
 
-static int32_t fuzzy_match_words(
-		const char *restrict patterns,
-		const char *restrict str);
+/*
+ * The bitmasks of where each character occurs in a word, for typo-tolerant
+ * matching. ASCII characters are looked up directly, and anything else by
+ * searching the few other characters in the word.
+ */
+struct typo_word {
+	uint32_t max_edits;
+	size_t nother;
+	uint64_t ascii[128];
+	uint32_t other[TYPO_MAX_CHARS];
+	uint64_t other_mask[TYPO_MAX_CHARS];
+};
 
+static int32_t match_normal(
+		const struct match_query *restrict query,
+		const char *restrict folded,
+		bool ascii,
+		struct match_spans *restrict spans);
+static int32_t match_prefix(
+		const struct match_query *restrict query,
+		const char *restrict str,
+		const char *restrict folded,
+		bool ascii,
+		struct match_spans *restrict spans);
+static int32_t match_fuzzy(
+		const struct match_query *restrict query,
+		const char *restrict str,
+		const char *restrict folded,
+		bool ascii,
+		struct match_spans *restrict spans);
+static int32_t match_typo(
+		const struct match_query *restrict query,
+		const char *restrict folded,
+		bool ascii,
+		struct match_spans *restrict spans);
 static int32_t fuzzy_match(
-		const char *restrict pattern,
-		const char *restrict str);
+		const struct match_word *restrict word,
+		const char *restrict str,
+		const char *restrict folded,
+		bool ascii,
+		struct match_spans *restrict spans);
+static int32_t typo_match(
+		const struct match_word *restrict word,
+		const struct typo_word *restrict typo,
+		const char *restrict folded,
+		bool ascii,
+		struct match_spans *restrict spans);
+static void typo_word_init(struct typo_word *typo, const struct match_word *word);
+static void initial_spans(
+		const struct match_query *restrict query,
+		const char *restrict str,
+		struct match_spans *restrict spans);
+static void add_span(struct match_spans *spans, uint32_t start, uint32_t end);
+static void finish_spans(struct match_spans *spans, const char *str, bool ascii);
+static uint32_t char_index(const char *s, size_t bytes, bool ascii);
+static uint32_t next_char(const char **s);
+
+static int32_t char_bonus(uint32_t cur, uint32_t prev);
+static bool is_upper(uint32_t c);
+static bool is_lower(uint32_t c);
+static bool is_alnum(uint32_t c);
 
-static int32_t fuzzy_match_recurse(
-		const char *restrict pattern,
+/*
+ * Convenience wrapper around match_query_score(), for one-off matches.
+ * If spans isn't NULL, the parts of str that matched are also stored there,
+ * as with match_query_spans().
+ */
+int32_t match_words(
+		enum matching_algorithm algorithm,
+		const char *restrict patterns,
 		const char *restrict str,
-		int32_t score,
-		bool first_match_only,
-		bool first_char);
+		struct match_spans *restrict spans)
+{
+	struct match_query query = match_query_create(algorithm, patterns);
+	char *folded = utf8_fold_dup(str);
+	int32_t score;
+	if (spans == NULL) {
+		score = match_query_score(&query, str, folded, simd_is_ascii(str));
+	} else {
+		score = match_query_spans(&query, str, folded, simd_is_ascii(str), spans);
+	}
+	free(folded);
+	match_query_destroy(&query);
+	return score;
+}
+
+/*
+ * Compile patterns into a query, to be matched against many strings.
+ *
+ * The patterns are normalised, case-folded and split into words, and each
+ * word is also decoded to UTF-32, so that none of this has to be done again
+ * for each string we match against.
+ */
+struct match_query match_query_create(
+		enum matching_algorithm algorithm,
+		const char *patterns)
+{
+	struct match_query query = {
+		.algorithm = algorithm
+	};
+
+	char *normalized = utf8_normalize(patterns);
+	if (normalized == NULL) {
+		normalized = xstrdup(patterns);
+	}
+	query.buffer = utf8_fold_dup(normalized);
+	free(normalized);
+
+	/*
+	 * Split the folded string into words in place, packing them together
+	 * so that we know exactly how much space we need for the rest.
+	 */
+	size_t total_len = 0;
+	char *dst = query.buffer;
+	char *saveptr = NULL;
+	char *word = strtok_r(query.buffer, " ", &saveptr);
+	while (word != NULL) {
+		size_t len = strlen(word);
+		memmove(dst, word, len + 1);
+		dst += len + 1;
+		total_len += len;
+		query.count++;
+		word = strtok_r(NULL, " ", &saveptr);
+	}
+
+	query.words = xcalloc(MAX(query.count, 1), sizeof(*query.words));
+	query.chars_buffer = xcalloc(total_len + 1, sizeof(*query.chars_buffer));
+
+	if (algorithm == MATCHING_ALGORITHM_TYPO) {
+		query.typo = xcalloc(MAX(query.count, 1), sizeof(*query.typo));
+	}
+
+	const char *str = query.buffer;
+	uint32_t *chars = query.chars_buffer;
+	for (size_t i = 0; i < query.count; i++) {
+		struct match_word *w = &query.words[i];
+		w->str = str;
+		w->len = strlen(str);
+		w->chars = chars;
+		for (const char *c = str; *c != '\0'; c = utf8_next_char(c)) {
+			*chars = utf8_to_utf32(c);
+			chars++;
+		}
+		w->nchars = chars - w->chars;
+		/*
+		 * Words which may contain typos don't need every one of their
+		 * characters to appear in a match, so can't be in the mask.
+		 */
+		if (query.typo == NULL) {
+			query.mask |= match_mask(str);
+		} else {
+			typo_word_init(&query.typo[i], w);
+			if (query.typo[i].max_edits == 0) {
+				query.mask |= match_mask(str);
+			}
+		}
+		str += w->len + 1;
+	}
+
+	/*
+	 * A single short word can also match the initials of a string (so
+	 * "vsc" matches "Visual Studio Code"), except when fuzzy matching,
+	 * which already matches those strings and favours them anyway.
+	 */
+	if (query.count == 1
+			&& algorithm != MATCHING_ALGORITHM_FUZZY
+			&& query.words[0].nchars >= 2
+			&& query.words[0].len <= sizeof(query.initials)) {
+		const struct match_word *w = &query.words[0];
+		for (size_t i = 0; i < w->len; i++) {
+			query.initials |= (uint64_t)(unsigned char)w->str[i] << (56 - 8 * i);
+		}
+		query.initials_mask = UINT64_MAX << (64 - 8 * w->len);
+	}
+
+	return query;
+}
+
+void match_query_destroy(struct match_query *restrict query)
+{
+	free(query->buffer);
+	free(query->words);
+	free(query->chars_buffer);
+	free(query->typo);
+}
+
+/*
+ * Return true if the search using query has been cancelled.
+ */
+bool match_query_cancelled(const struct match_query *restrict query)
+{
+	return query->cancel != NULL && atomic_load_explicit(query->cancel, memory_order_relaxed);
+}
+
+/*
+ * Return true if parent is contained in child, in the sense that any string
+ * that child matches must also be matched by parent, so that the results of
+ * parent can be filtered by child instead of filtering everything.
+ *
+ * This is the case if each of parent's words is contained in one of child's
+ * words, where containment depends on the algorithm:
+ *   - Normal: parent's word is a substring of child's word.
+ *   - Prefix: parent's word is a prefix of child's word.
+ *   - Fuzzy: parent's word is a subsequence of child's word.
+ *   - Typo: parent's word is a substring of child's word, and allows at
+ *     least as many typos.
+ *
+ * If child can match initials, so must parent, with a prefix of child's
+ * word, as otherwise parent may have missed some of child's acronym matches.
+ */
+bool match_query_narrows(
+		const struct match_query *restrict parent,
+		const struct match_query *restrict child)
+{
+	if (parent->algorithm != child->algorithm) {
+		return false;
+	}
+	if (child->initials_mask != 0 && parent->count > 0) {
+		if (parent->initials_mask == 0
+				|| (child->initials & parent->initials_mask) != parent->initials) {
+			return false;
+		}
+	}
+	for (size_t i = 0; i < parent->count; i++) {
+		const struct match_word *p = &parent->words[i];
+		bool found = false;
+		for (size_t j = 0; j < child->count && !found; j++) {
+			const struct match_word *c = &child->words[j];
+			switch (parent->algorithm) {
+				case MATCHING_ALGORITHM_NORMAL:
+					found = strstr(c->str, p->str) != NULL;
+					break;
+				case MATCHING_ALGORITHM_PREFIX:
+					found = strncmp(c->str, p->str, p->len) == 0;
+					break;
+				case MATCHING_ALGORITHM_FUZZY: {
+					size_t k = 0;
+					for (size_t l = 0; l < c->nchars && k < p->nchars; l++) {
+						if (c->chars[l] == p->chars[k]) {
+							k++;
+						}
+					}
+					found = k == p->nchars;
+					break;
+				}
+				case MATCHING_ALGORITHM_TYPO:
+					found = strstr(c->str, p->str) != NULL
+						&& parent->typo[i].max_edits >= child->typo[j].max_edits;
+					break;
+			}
+		}
+		if (!found) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Return a bitmask of which characters occur in folded.
+ *
+ * Bits 0-25 are set for the letters a-z, bits 26-35 for the digits 0-9, and
+ * every other character is hashed into one of the remaining 28 bits. Every
+ * algorithm requires each character of each search word to appear somewhere
+ * in a matching string, so if a string's mask doesn't contain all of the bits
+ * of the query's mask, it can be rejected without any further searching.
+ */
+uint64_t match_mask(const char *folded)
+{
+	uint64_t mask = 0;
+	const char *c = folded;
+	while (*c != '\0') {
+		uint32_t ch = next_char(&c);
+		if (ch >= 'a' && ch <= 'z') {
+			mask |= 1ull << (ch - 'a');
+		} else if (ch >= '0' && ch <= '9') {
+			mask |= 1ull << (26 + ch - '0');
+		} else {
+			mask |= 1ull << (36 + ch % 28);
+		}
+	}
+	return mask;
+}
+
+/*
+ * Return the initials of str, i.e. the first character of each of its words,
+ * case-folded and packed into a uint64_t from the most significant byte down,
+ * so that checking whether a query matches them is a single comparison.
+ * Words start wherever char_bonus() would give a bonus, so "Visual Studio
+ * Code" and "VisualStudioCode" both have the initials "vsc". Only as many
+ * initials as fit in 8 bytes of UTF-8 are kept.
+ */
+uint64_t match_initials(const char *str)
+{
+	uint64_t initials = 0;
+	unsigned int shift = 64;
+	uint32_t prev = 0;
+	const char *c = str;
+	while (*c != '\0') {
+		uint32_t cur = next_char(&c);
+		if (char_bonus(cur, prev) > 0) {
+			char buf[6];
+			uint8_t len = utf32_to_utf8(utf32_tolower(cur), buf);
+			if (8u * len > shift) {
+				break;
+			}
+			for (uint8_t i = 0; i < len; i++) {
+				shift -= 8;
+				initials |= (uint64_t)(unsigned char)buf[i] << shift;
+			}
+		}
+		prev = cur;
+	}
+	return initials;
+}
 
-static int32_t compute_score(
-		int32_t jump,
-		bool first_char,
-		const char *restrict match);
+/*
+ * Return the score of matching query against a string's initials (as
+ * returned by match_initials()), or INT32_MIN if they don't match, or query
+ * can't match initials. Matching all of the initials scores 0, the same as
+ * an exact match at the start of a string, with a point off for each byte of
+ * initials left over.
+ */
+int32_t match_query_acronym(
+		const struct match_query *restrict query,
+		uint64_t initials)
+{
+	if (query->initials_mask == 0
+			|| (initials & query->initials_mask) != query->initials) {
+		return INT32_MIN;
+	}
+	uint64_t rest = initials & ~query->initials_mask;
+	if (rest == 0) {
+		return 0;
+	}
+	int32_t len = __builtin_popcountll(query->initials_mask) / 8;
+	int32_t unused = __builtin_ctzll(rest) / 8;
+	return -(8 - len - unused);
+}
 
 /*
  * Select the appropriate algorithm, and return its score.
  * Each algorithm returns larger scores for better matches,
  * and returns INT32_MIN if a word is not found.
+ *
+ * folded should be the result of utf8_fold(str), and ascii should be
+ * simd_is_ascii(str), in which case faster byte-wise versions of the
+ * algorithms are used.
+ *
+ * When matching many strings, it's better to choose the algorithm once, and
+ * call the match_query_normal() etc. functions directly.
  */
-int32_t match_words(
-		enum matching_algorithm algorithm,
-		const char *restrict patterns,
-		const char *restrict str)
+int32_t match_query_score(
+		const struct match_query *restrict query,
+		const char *restrict str,
+		const char *restrict folded,
+		bool ascii)
 {
-	switch (algorithm) {
+	int32_t score;
+	switch (query->algorithm) {
 		case MATCHING_ALGORITHM_NORMAL:
-			return simple_match_words(patterns, str);
+			score = match_query_normal(query, str, folded, ascii);
+			break;
 		case MATCHING_ALGORITHM_PREFIX:
-			return prefix_match_words(patterns, str);
+			score = match_query_prefix(query, str, folded, ascii);
+			break;
 		case MATCHING_ALGORITHM_FUZZY:
-			return fuzzy_match_words(patterns, str);
+			score = match_query_fuzzy(query, str, folded, ascii);
+			break;
+		case MATCHING_ALGORITHM_TYPO:
+			score = match_query_typo(query, str, folded, ascii);
+			break;
 		default:
-			return INT32_MIN;
+			score = INT32_MIN;
+			break;
+	}
+	if (query->initials_mask != 0) {
+		score = MAX(score, match_query_acronym(query, match_initials(str)));
 	}
+	return score;
 }
 
 /*
- * Split patterns into words, and perform simple matching against str for each.
+ * Like match_query_score(), but also store the ranges of str which matched
+ * in spans, e.g. for highlighting. The spans are sorted, don't overlap, and
+ * are in bytes of str (not of folded). If there are too many to store, some
+ * are left out. If str doesn't match, spans is left empty.
+ */
+int32_t match_query_spans(
+		const struct match_query *restrict query,
+		const char *restrict str,
+		const char *restrict folded,
+		bool ascii,
+		struct match_spans *restrict spans)
+{
+	spans->count = 0;
+	int32_t score;
+	switch (query->algorithm) {
+		case MATCHING_ALGORITHM_NORMAL:
+			score = match_normal(query, folded, ascii, spans);
+			break;
+		case MATCHING_ALGORITHM_PREFIX:
+			score = match_prefix(query, str, folded, ascii, spans);
+			break;
+		case MATCHING_ALGORITHM_FUZZY:
+			score = match_fuzzy(query, str, folded, ascii, spans);
+			break;
+		case MATCHING_ALGORITHM_TYPO:
+			score = match_typo(query, folded, ascii, spans);
+			break;
+		default:
+			score = INT32_MIN;
+			break;
+	}
+	if (query->initials_mask != 0) {
+		int32_t acronym_score = match_query_acronym(query, match_initials(str));
+		if (acronym_score > score) {
+			spans->count = 0;
+			initial_spans(query, str, spans);
+			score = acronym_score;
+		}
+	}
+	if (score == INT32_MIN) {
+		spans->count = 0;
+	} else {
+		finish_spans(spans, str, ascii);
+	}
+	return score;
+}
+
+/*
+ * The public versions of each algorithm, for filtering. As the real versions
+ * are inlined into these with spans == NULL, they don't pay anything for
+ * being able to record spans.
+ */
+int32_t match_query_normal(
+		const struct match_query *restrict query,
+		const char *restrict str,
+		const char *restrict folded,
+		bool ascii)
+{
+	return match_normal(query, folded, ascii, NULL);
+}
+
+int32_t match_query_prefix(
+		const struct match_query *restrict query,
+		const char *restrict str,
+		const char *restrict folded,
+		bool ascii)
+{
+	return match_prefix(query, str, folded, ascii, NULL);
+}
+
+int32_t match_query_fuzzy(
+		const struct match_query *restrict query,
+		const char *restrict str,
+		const char *restrict folded,
+		bool ascii)
+{
+	return match_fuzzy(query, str, folded, ascii, NULL);
+}
+
+int32_t match_query_typo(
+		const struct match_query *restrict query,
+		const char *restrict str,
+		const char *restrict folded,
+		bool ascii)
+{
+	return match_typo(query, folded, ascii, NULL);
+}
+
+/*
+ * Perform simple matching of each word against folded.
  * Returns the negative sum of substring distances from the start of str.
  * If a word is not found, returns INT32_MIN.
+ *
+ * As both str and words are already folded, this is just a byte-wise search,
+ * which is also correct for non-ASCII UTF-8.
+ *
+ * If spans isn't NULL, the character ranges of each match are added to it
+ * (as they are for the other algorithms).
  */
-int32_t simple_match_words(const char *restrict patterns, const char *restrict str)
+[[gnu::always_inline]]
+static inline int32_t match_normal(
+		const struct match_query *restrict query,
+		const char *restrict folded,
+		bool ascii,
+		struct match_spans *restrict spans)
 {
 	int32_t score = 0;
-	char *saveptr = NULL;
-	char *tmp = utf8_normalize(patterns);
-	char *pattern = strtok_r(tmp, " ", &saveptr);
-	while (pattern != NULL) {
-		char *c = utf8_strcasestr(str, pattern);
+	for (size_t i = 0; i < query->count; i++) {
+		const struct match_word *word = &query->words[i];
+		const char *c = simd_strstr(folded, word->str, word->len);
 		if (c == NULL) {
-			score = INT32_MIN;
-			break;
-		} else {
-			score -= c - str;
+			return INT32_MIN;
+		}
+		score -= c - folded;
+		if (spans != NULL) {
+			uint32_t start = char_index(folded, c - folded, ascii);
+			add_span(spans, start, start + word->nchars);
 		}
-		pattern = strtok_r(NULL, " ", &saveptr);
 	}
-	free(tmp);
 	return score;
 }
 
 /*
- * Split patterns into words, and perform prefix matching against str for each.
+ * Perform prefix matching of each word against folded.
  * Returns the negative sum of remaining string suffix lengths.
  * If a word is not found, returns INT32_MIN.
  */
-int32_t prefix_match_words(const char *restrict patterns, const char *restrict str)
+[[gnu::always_inline]]
+static inline int32_t match_prefix(
+		const struct match_query *restrict query,
+		const char *restrict str,
+		const char *restrict folded,
+		bool ascii,
+		struct match_spans *restrict spans)
 {
 	int32_t score = 0;
-	char *saveptr = NULL;
-	char *tmp = utf8_normalize(patterns);
-	char *pattern = strtok_r(tmp, " ", &saveptr);
-	while (pattern != NULL) {
-		char *c = utf8_strcasestr(str, pattern);
-		if (c != str) {
-			score = INT32_MIN;
-			break;
-		} else {
-			score -= utf8_strlen(str) - utf8_strlen(pattern);
+	size_t slen = 0;
+	for (size_t i = 0; i < query->count; i++) {
+		const struct match_word *word = &query->words[i];
+		if (strncmp(folded, word->str, word->len) != 0) {
+			return INT32_MIN;
+		}
+		if (slen == 0) {
+			slen = ascii ? strlen(str) : utf8_strlen(folded);
+		}
+		score -= slen - word->nchars;
+		if (spans != NULL) {
+			add_span(spans, 0, word->nchars);
 		}
-		pattern = strtok_r(NULL, " ", &saveptr);
 	}
-	free(tmp);
 	return score;
 }
 
 
 /*
- * Split patterns into words, and return the sum of fuzzy_match(word, str).
+ * Return the sum of fuzzy_match(word, str) for each word.
  * If a word is not found, returns INT32_MIN.
  */
-int32_t fuzzy_match_words(const char *restrict patterns, const char *restrict str)
+[[gnu::always_inline]]
+static inline int32_t match_fuzzy(
+		const struct match_query *restrict query,
+		const char *restrict str,
+		const char *restrict folded,
+		bool ascii,
+		struct match_spans *restrict spans)
 {
 	int32_t score = 0;
-	char *saveptr = NULL;
-	char *tmp = utf8_normalize(patterns);
-	char *pattern = strtok_r(tmp, " ", &saveptr);
-	while (pattern != NULL) {
-		int32_t word_score = fuzzy_match(pattern, str);
+	for (size_t i = 0; i < query->count; i++) {
+		int32_t word_score = fuzzy_match(&query->words[i], str, folded, ascii, spans);
 		if (word_score == INT32_MIN) {
-			score = INT32_MIN;
-			break;
-		} else {
-			score += word_score;
+			return INT32_MIN;
 		}
-		pattern = strtok_r(NULL, " ", &saveptr);
+		score += word_score;
 	}
-	free(tmp);
 	return score;
 }
 
 /*
- * Returns score if each character in pattern is found sequentially within str.
- * Returns INT32_MIN otherwise.
+ * Return the sum of typo_match(word, folded) for each word.
+ * If a word is not found, returns INT32_MIN.
  */
-int32_t fuzzy_match(const char *restrict pattern, const char *restrict str)
+[[gnu::always_inline]]
+static inline int32_t match_typo(
+		const struct match_query *restrict query,
+		const char *restrict folded,
+		bool ascii,
+		struct match_spans *restrict spans)
 {
-	const int unmatched_letter_penalty = -1;
-	const size_t slen = utf8_strlen(str);
-	const size_t plen = utf8_strlen(pattern);
 	int32_t score = 0;
+	for (size_t i = 0; i < query->count; i++) {
+		int32_t word_score = typo_match(
+				&query->words[i],
+				&query->typo[i],
+				folded,
+				ascii,
+				spans);
+		if (word_score == INT32_MIN) {
+			return INT32_MIN;
+		}
+		score += word_score;
+	}
+	return score;
+}
+
+/*
+ * Add the positions of the initials of str that query matched to spans.
+ */
+void initial_spans(
+		const struct match_query *restrict query,
+		const char *restrict str,
+		struct match_spans *restrict spans)
+{
+	size_t count = 0;
+	uint32_t prev = 0;
+	uint32_t pos = 0;
+	const char *c = str;
+	while (*c != '\0' && count < query->words[0].nchars) {
+		uint32_t cur = next_char(&c);
+		if (char_bonus(cur, prev) > 0) {
+			add_span(spans, pos, pos + 1);
+			count++;
+		}
+		prev = cur;
+		pos++;
+	}
+}
 
-	if (*pattern == '\0') {
-		return score;
+/*
+ * Add the character range [start, end) to spans, merging it with the last
+ * span if they touch, which is common for fuzzy matches.
+ */
+void add_span(struct match_spans *spans, uint32_t start, uint32_t end)
+{
+	if (spans->count > 0) {
+		struct match_span *last = &spans->span[spans->count - 1];
+		if (start <= last->end && end >= last->start) {
+			last->start = MIN(last->start, start);
+			last->end = MAX(last->end, end);
+			return;
+		}
 	}
-	if (slen < plen) {
-		return INT32_MIN;
+	if (spans->count < MATCH_MAX_SPANS) {
+		spans->span[spans->count] = (struct match_span){
+			.start = start,
+			.end = end
+		};
+		spans->count++;
 	}
+}
 
-	/* We can already penalise any unused letters. */
-	score += unmatched_letter_penalty * (int32_t)(slen - plen);
-
-        /*
-         * If the string is more than 100 characters, just find the first fuzzy
-         * match rather than the best.
-         *
-         * This is required as the number of possible matches (for patterns and
-         * strings all consisting of one letter) scales something like:
-         *
-         * slen! / (plen! (slen - plen)!)  ~  slen^plen for plen << slen
-         *
-         * This quickly grinds everything to a halt. 100 is chosen fairly
-         * arbitrarily from the following logic:
-         *
-         * - e is the most common character in English, at around 13% of
-         *   letters. Depending on the context, let's say this be up to 20%.
-         * - 100 * 0.20 = 20 repeats of the same character.
-         * - In the worst case here, 20! / (10! 10!) ~200,000 possible matches,
-         *   which is "slow but not frozen" for my machine.
-         *
-         * In reality, this worst case shouldn't be hit, and finding the "best"
-         * fuzzy match in lines of text > 100 characters isn't really in scope
-         * for a dmenu clone.
-         */
-        bool first_match_only = slen > 100;
-
-	/* Perform the match. */
-	score = fuzzy_match_recurse(pattern, str, score, first_match_only, true);
+/*
+ * Sort and merge the character ranges in spans, then convert them to byte
+ * offsets in str. Folding never changes the number of characters in a
+ * string, so character positions in folded are the same as in str.
+ */
+void finish_spans(struct match_spans *spans, const char *str, bool ascii)
+{
+	/* There are never many spans, so just insertion sort them. */
+	for (size_t i = 1; i < spans->count; i++) {
+		struct match_span tmp = spans->span[i];
+		size_t j = i;
+		while (j > 0 && spans->span[j - 1].start > tmp.start) {
+			spans->span[j] = spans->span[j - 1];
+			j--;
+		}
+		spans->span[j] = tmp;
+	}
+	size_t n = 0;
+	for (size_t i = 0; i < spans->count; i++) {
+		if (n > 0 && spans->span[i].start <= spans->span[n - 1].end) {
+			spans->span[n - 1].end = MAX(spans->span[n - 1].end, spans->span[i].end);
+		} else {
+			spans->span[n++] = spans->span[i];
+		}
+	}
+	spans->count = n;
+	if (ascii) {
+		return;
+	}
 
-	return score;
+	/* The boundaries are now in order, so this only needs one pass. */
+	const char *c = str;
+	uint32_t pos = 0;
+	for (size_t i = 0; i < spans->count; i++) {
+		uint32_t *bounds[2] = { &spans->span[i].start, &spans->span[i].end };
+		for (size_t j = 0; j < 2; j++) {
+			while (pos < *bounds[j] && *c != '\0') {
+				next_char(&c);
+				pos++;
+			}
+			*bounds[j] = c - str;
+		}
+	}
 }
 
 /*
- * Recursively match the whole of pattern against str.
- * The score parameter is the score of the previously matched character.
+ * Return the number of characters in the first bytes bytes of the UTF-8
+ * string s.
+ */
+uint32_t char_index(const char *s, size_t bytes, bool ascii)
+{
+	if (ascii) {
+		return bytes;
+	}
+	uint32_t count = 0;
+	for (size_t i = 0; i < bytes; i++) {
+		/* Count everything but continuation bytes. */
+		if (((unsigned char)s[i] & 0xC0) != 0x80) {
+			count++;
+		}
+	}
+	return count;
+}
+
+/*
+ * Return the character at *s and move *s past it. Strings may not be valid
+ * UTF-8, so each byte of any invalid sequence is read as UTF8_REPLACEMENT_CHAR,
+ * as utf8_fold() does, which keeps positions in a string and its folded copy
+ * in step.
+ */
+uint32_t next_char(const char **s)
+{
+	unsigned char c = **s;
+	if (c < 0x80) {
+		(*s)++;
+		return c;
+	}
+	uint32_t ch = utf8_decode(s);
+	if (ch == UTF8_INVALID) {
+		return UTF8_REPLACEMENT_CHAR;
+	}
+	return ch;
+}
+
+static thread_local struct {
+	size_t size;
+	uint32_t *chars;
+	int32_t *bonus;
+	int32_t *score;
+	int32_t *best;
+	size_t trace_size;
+	int32_t *trace;
+} scratch;
+
+static void scratch_reserve(size_t size)
+{
+	if (size <= scratch.size) {
+		return;
+	}
+	size_t new_size = MAX(2 * scratch.size, 128);
+	while (new_size < size) {
+		new_size *= 2;
+	}
+	scratch.chars = xrealloc(scratch.chars, new_size * sizeof(*scratch.chars));
+	scratch.bonus = xrealloc(scratch.bonus, new_size * sizeof(*scratch.bonus));
+	scratch.score = xrealloc(scratch.score, new_size * sizeof(*scratch.score));
+	scratch.best = xrealloc(scratch.best, new_size * sizeof(*scratch.best));
+	scratch.size = new_size;
+}
+
+/*
+ * Returns score if each character in word is found sequentially within str.
+ * Returns INT32_MIN otherwise.
+ *
+ * The score is that of the best possible alignment of word within str,
+ * scored as described in char_bonus() below. Rather than trying every
+ * alignment, which takes exponential time, we find the best one with a
+ * Smith-Waterman style dynamic programming approach (as used by fzf), which
+ * takes O(strlen(word) * strlen(str)) time and O(strlen(str)) memory.
+ *
+ * For each character of word in turn, score[i] holds the best score of
+ * any alignment of the word so far which ends with a match at str[i], and
+ * best[i] holds the maximum of score[0..i]. The next character's scores then
+ * only depend on the previous character's, as a match at str[i] can either
+ * directly follow a match at str[i - 1] (getting an adjacency bonus), or
+ * follow the best match anywhere before it.
  *
- * This reaches a maximum recursion depth of strlen(pattern) + 1. However, the
- * stack usage is small (the maximum I've seen on x86_64 is 144 bytes with
- * gcc -O3), so this shouldn't matter unless pattern contains thousands of
- * characters.
+ * If spans isn't NULL, every character's scores are kept in scratch.trace,
+ * so that we can then trace back through them to find which characters made
+ * up the best alignment. This needs O(strlen(word) * strlen(str)) memory, so
+ * is only done when asked.
  */
-int32_t fuzzy_match_recurse(
-		const char *restrict pattern,
+int32_t fuzzy_match(
+		const struct match_word *restrict word,
 		const char *restrict str,
-		int32_t score,
-		bool first_match_only,
-		bool first_char)
+		const char *restrict folded,
+		bool ascii,
+		struct match_spans *restrict spans)
 {
-	if (*pattern == '\0') {
-		/* We've matched the full pattern. */
-		return score;
-	}
+	const int unmatched_letter_penalty = -1;
+	const int adjacency_bonus = 15;
+	const int first_letter_bonus = 15;
+	const int leading_letter_penalty = -5;
+	const int max_leading_letter_penalty = -15;
 
-	const char *match = str;
-	uint32_t search = utf8_to_utf32(pattern);
+	/* Any score below this can't have come from a real match. */
+	const int32_t no_match = INT32_MIN / 2;
 
-	int32_t best_score = INT32_MIN;
+	if (word->len == 0) {
+		return 0;
+	}
 
 	/*
-	 * Find all occurrences of the next pattern character in str, and
-	 * recurse on them.
+	 * Most strings won't match at all, so check that quickly before
+	 * doing any real work. For ASCII strings, every character is a
+	 * single byte, so we can skip decoding anything.
 	 */
-	while ((match = utf8_strcasechr(match, search)) != NULL) {
-		int32_t jump = 0;
-		for (const char *tmp = str; tmp != match; tmp = utf8_next_char(tmp)) {
-			jump++;
-		}
-		int32_t subscore = fuzzy_match_recurse(
-				utf8_next_char(pattern),
-				utf8_next_char(match),
-				compute_score(jump, first_char, match),
-				first_match_only,
-				false);
-		best_score = MAX(best_score, subscore);
-		match = utf8_next_char(match);
-
-		if (first_match_only) {
-			break;
+	const char *f = folded;
+	if (ascii) {
+		for (const char *p = word->str; *p != '\0'; p++) {
+			f = simd_strchr(f, *p);
+			if (f == NULL) {
+				return INT32_MIN;
+			}
+			f++;
+		}
+	} else {
+		for (size_t k = 0; k < word->nchars; k++) {
+			f = utf8_strchr(f, word->chars[k]);
+			if (f == NULL) {
+				return INT32_MIN;
+			}
+			f = utf8_next_char(f);
 		}
 	}
 
-	if (best_score == INT32_MIN) {
-		/* We couldn't match the rest of the pattern. */
-		return INT32_MIN;
+	const size_t slen = ascii ? strlen(str) : utf8_strlen(folded);
+	const size_t plen = word->nchars;
+	scratch_reserve(slen);
+	if (spans != NULL && plen * slen > scratch.trace_size) {
+		scratch.trace_size = plen * slen;
+		scratch.trace = xrealloc(scratch.trace, scratch.trace_size * sizeof(*scratch.trace));
+	}
+
+	/* Decode the string, and work out the bonus for each character. */
+	if (ascii) {
+		scratch.chars[0] = (unsigned char)folded[0];
+		scratch.bonus[0] = 0;
+		for (size_t i = 1; i < slen; i++) {
+			scratch.chars[i] = (unsigned char)folded[i];
+			scratch.bonus[i] = char_bonus(
+					(unsigned char)str[i],
+					(unsigned char)str[i - 1]);
+		}
 	} else {
-		return score + best_score;
+		uint32_t prev = 0;
+		const char *c = str;
+		f = folded;
+		for (size_t i = 0; i < slen; i++) {
+			uint32_t cur = next_char(&c);
+			scratch.chars[i] = utf8_to_utf32(f);
+			scratch.bonus[i] = i > 0 ? char_bonus(cur, prev) : 0;
+			prev = cur;
+			f = utf8_next_char(f);
+		}
+	}
+
+	/* Scores for the first character of word. */
+	uint32_t pc = word->chars[0];
+	int32_t running_best = no_match;
+	for (size_t i = 0; i < slen; i++) {
+		int32_t score = no_match;
+		if (scratch.chars[i] == pc) {
+			if (i == 0) {
+				score = first_letter_bonus;
+			} else {
+				score = scratch.bonus[i]
+					+ MAX(leading_letter_penalty * (int32_t)i,
+						max_leading_letter_penalty);
+			}
+		}
+		scratch.score[i] = score;
+		running_best = MAX(running_best, score);
+		scratch.best[i] = running_best;
+	}
+	if (spans != NULL) {
+		memcpy(scratch.trace, scratch.score, slen * sizeof(*scratch.score));
+	}
+
+	/* And the rest of it. */
+	for (size_t k = 1; k < plen; k++) {
+		pc = word->chars[k];
+
+		/*
+		 * Update in place, from the end of the string backwards, so
+		 * that score[i - 1] and best[i - 1] still hold the previous
+		 * character's values when we need them.
+		 */
+		for (size_t i = slen - 1; i >= k; i--) {
+			int32_t score = no_match;
+			if (scratch.chars[i] == pc && scratch.best[i - 1] != no_match) {
+				score = MAX(scratch.score[i - 1] + adjacency_bonus,
+						scratch.best[i - 1]);
+				score += scratch.bonus[i];
+			}
+			scratch.score[i] = score;
+		}
+		scratch.score[k - 1] = no_match;
+		if (spans != NULL) {
+			memcpy(&scratch.trace[k * slen],
+					scratch.score,
+					slen * sizeof(*scratch.score));
+		}
+
+		running_best = no_match;
+		for (size_t i = 0; i < slen; i++) {
+			running_best = MAX(running_best, scratch.score[i]);
+			scratch.best[i] = running_best;
+		}
+	}
+
+	if (scratch.best[slen - 1] == no_match) {
+		return INT32_MIN;
+	}
+
+	if (spans != NULL) {
+		/*
+		 * Find where the best alignment ends, then work backwards,
+		 * repeating the choice made for each character above.
+		 */
+		size_t i = 0;
+		const int32_t *row = &scratch.trace[(plen - 1) * slen];
+		while (row[i] != scratch.best[slen - 1]) {
+			i++;
+		}
+		for (size_t k = plen - 1; k > 0; k--) {
+			add_span(spans, i, i + 1);
+			int32_t score = row[i] - scratch.bonus[i];
+			row = &scratch.trace[(k - 1) * slen];
+			if (row[i - 1] != no_match && row[i - 1] + adjacency_bonus == score) {
+				i--;
+			} else {
+				do {
+					i--;
+				} while (row[i] != score);
+			}
+		}
+		add_span(spans, i, i + 1);
+	}
+
+	/* Penalise any unused letters. */
+	return scratch.best[slen - 1]
+		+ unmatched_letter_penalty * (int32_t)(slen - plen);
+}
+
+/*
+ * How many typos to allow in a word of nchars characters. Short words
+ * have to match exactly, as otherwise they'd match almost anything.
+ */
+static uint32_t typo_max_edits(size_t nchars)
+{
+	if (nchars > TYPO_MAX_CHARS || nchars < 5) {
+		return 0;
+	}
+	if (nchars < 9) {
+		return 1;
+	}
+	return 2;
+}
+
+void typo_word_init(struct typo_word *typo, const struct match_word *word)
+{
+	typo->max_edits = typo_max_edits(word->nchars);
+	if (typo->max_edits == 0) {
+		return;
+	}
+	for (size_t i = 0; i < word->nchars; i++) {
+		uint32_t c = word->chars[i];
+		if (c < 0x80) {
+			typo->ascii[c] |= 1ull << i;
+			continue;
+		}
+		size_t j = 0;
+		while (j < typo->nother && typo->other[j] != c) {
+			j++;
+		}
+		if (j == typo->nother) {
+			typo->other[j] = c;
+			typo->nother++;
+		}
+		typo->other_mask[j] |= 1ull << i;
 	}
 }
 
 /*
- * Calculate the score for a single matching letter.
+ * Returns a score if word occurs somewhere in folded with at most
+ * typo->max_edits typos, or INT32_MIN otherwise. A typo is an inserted,
+ * deleted or substituted character, or a swap of two adjacent characters.
+ *
+ * The score is minus the position of the match, as for match_normal(),
+ * minus TYPO_PENALTY for each typo, so fewer typos always rank higher.
+ *
+ * This is Myers' bit-parallel approximate string matching algorithm, with
+ * Hyyrö's extension for transpositions. Each bit of the bit-vectors holds
+ * one row of the edit distance matrix of word against folded, so the whole
+ * column for each character of folded is calculated in a few instructions,
+ * in O(strlen(folded)) time overall.
+ */
+int32_t typo_match(
+		const struct match_word *restrict word,
+		const struct typo_word *restrict typo,
+		const char *restrict folded,
+		bool ascii,
+		struct match_spans *restrict spans)
+{
+	if (typo->max_edits == 0) {
+		const char *c = simd_strstr(folded, word->str, word->len);
+		if (c == NULL) {
+			return INT32_MIN;
+		}
+		if (spans != NULL) {
+			uint32_t start = char_index(folded, c - folded, ascii);
+			add_span(spans, start, start + word->nchars);
+		}
+		return -(c - folded);
+	}
+
+	/*
+	 * pv and mv hold whether each row's distance increases or decreases
+	 * from the row above, d0 whether it's the same as the diagonal.
+	 */
+	const uint64_t last_row = 1ull << (word->nchars - 1);
+	uint64_t pv = UINT64_MAX;
+	uint64_t mv = 0;
+	uint64_t d0 = 0;
+	uint64_t prev_eq = 0;
+	uint32_t distance = word->nchars;
+	uint32_t best = UINT32_MAX;
+	uint32_t best_end = 0;
+
+	const char *c = folded;
+	for (uint32_t pos = 0; *c != '\0'; pos++) {
+		uint64_t eq = 0;
+		if ((unsigned char)*c < 0x80) {
+			eq = typo->ascii[(unsigned char)*c];
+			c++;
+		} else {
+			uint32_t ch = utf8_to_utf32(c);
+			for (size_t j = 0; j < typo->nother; j++) {
+				if (typo->other[j] == ch) {
+					eq = typo->other_mask[j];
+					break;
+				}
+			}
+			c = utf8_next_char(c);
+		}
+
+		uint64_t tr = ((~d0 & eq) << 1) & prev_eq;
+		d0 = (((eq & pv) + pv) ^ pv) | eq | mv | tr;
+		uint64_t ph = mv | ~(d0 | pv);
+		uint64_t mh = pv & d0;
+		if (ph & last_row) {
+			distance++;
+		} else if (mh & last_row) {
+			distance--;
+		}
+		/*
+		 * Matches can start anywhere in folded, so the top row is
+		 * always zero, and nothing is shifted in at the bottom.
+		 */
+		ph <<= 1;
+		mh <<= 1;
+		pv = mh | ~(d0 | ph);
+		mv = ph & d0;
+		prev_eq = eq;
+
+		if (distance < best) {
+			best = distance;
+			best_end = pos + 1;
+			if (best == 0) {
+				break;
+			}
+		}
+	}
+	if (best > typo->max_edits) {
+		return INT32_MIN;
+	}
+
+	/*
+	 * We only know where the match ends, so assume it's the same length
+	 * as word, which is only out when there are insertions or deletions.
+	 */
+	uint32_t start = best_end > word->nchars ? best_end - word->nchars : 0;
+	if (spans != NULL) {
+		add_span(spans, start, best_end);
+	}
+	return -(int32_t)start - TYPO_PENALTY * (int32_t)best;
+}
+
+/*
+ * Calculate the bonus for matching the character cur, which follows prev.
  * The scoring system is taken from fts_fuzzy_match v0.2.0 by Forrest Smith,
  * which is licensed to the public domain.
  *
@@ -254,48 +1111,58 @@ int32_t fuzzy_match_recurse(
  *     - If there are multiple adjacent matches.
  *     - If a match occurs after a separator character.
  *     - If a match is uppercase, and the previous character is lowercase.
+ *     - If the first match is at the start of the string.
  *
  *   - Penalties:
  *     - If there are letters before the first match.
- *     - If there are superfluous characters in str (already accounted for).
+ *     - If there are superfluous characters in str.
+ *
+ * Only the separator and camel case bonuses depend on the characters
+ * themselves, so those are calculated here, and the rest in fuzzy_match().
  */
-int32_t compute_score(int32_t jump, bool first_char, const char *restrict match)
+int32_t char_bonus(uint32_t cur, uint32_t prev)
 {
-	const int adjacency_bonus = 15;
 	const int separator_bonus = 30;
 	const int camel_bonus = 30;
-	const int first_letter_bonus = 15;
-
-	const int leading_letter_penalty = -5;
-	const int max_leading_letter_penalty = -15;
 
 	int32_t score = 0;
 
-	const uint32_t cur = utf8_to_utf32(match);
-
-	/* Apply bonuses. */
-	if (!first_char && jump == 0) {
-		score += adjacency_bonus;
+	if (is_upper(cur) && is_lower(prev)) {
+		score += camel_bonus;
 	}
-	if (!first_char || jump > 0) {
-		const uint32_t prev = utf8_to_utf32(utf8_prev_char(match));
-		if (utf32_isupper(cur) && utf32_islower(prev)) {
-			score += camel_bonus;
-		}
-		if (utf32_isalnum(cur) && !utf32_isalnum(prev)) {
-			score += separator_bonus;
-		}
+	if (is_alnum(cur) && !is_alnum(prev)) {
+		score += separator_bonus;
 	}
-	if (first_char && jump == 0) {
-		/* Match at start of string gets separator bonus. */
-		score += first_letter_bonus;
+
+	return score;
+}
+
+/*
+ * Character classification for char_bonus(), skipping the Unicode table
+ * lookups for ASCII.
+ */
+bool is_upper(uint32_t c)
+{
+	if (c < 0x80) {
+		return c >= 'A' && c <= 'Z';
 	}
+	return utf32_isupper(c);
+}
 
-	/* Apply penalties. */
-	if (first_char) {
-		score += MAX(leading_letter_penalty * jump,
-				max_leading_letter_penalty);
+bool is_lower(uint32_t c)
+{
+	if (c < 0x80) {
+		return c >= 'a' && c <= 'z';
 	}
+	return utf32_islower(c);
+}
 
-	return score;
+bool is_alnum(uint32_t c)
+{
+	if (c < 0x80) {
+		return (c >= 'a' && c <= 'z')
+			|| (c >= 'A' && c <= 'Z')
+			|| (c >= '0' && c <= '9');
+	}
+	return utf32_isalnum(c);
 }
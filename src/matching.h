@@ -1,14 +1,123 @@
 #ifndef MATCHING_H
 #define MATCHING_H
 
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 enum matching_algorithm {
 	MATCHING_ALGORITHM_NORMAL,
 	MATCHING_ALGORITHM_PREFIX,
-	MATCHING_ALGORITHM_FUZZY
+	MATCHING_ALGORITHM_FUZZY,
+	MATCHING_ALGORITHM_TYPO
 };
 
-int32_t match_words(enum matching_algorithm algorithm, const char *restrict patterns, const char *restrict str);
+/* A single normalised, case-folded search word. */
+struct match_word {
+	const char *str;
+	const uint32_t *chars;
+	size_t len;
+	size_t nchars;
+};
+
+struct typo_word;
+
+/*
+ * A search string, compiled once and then matched against many strings.
+ *
+ * If cancel is set, long searches with this query check it every so often,
+ * and stop early once it becomes true, leaving their results incomplete.
+ */
+struct match_query {
+	enum matching_algorithm algorithm;
+	size_t count;
+	struct match_word *words;
+	uint64_t mask;
+	char *buffer;
+	uint32_t *chars_buffer;
+	/* Per-word tables for MATCHING_ALGORITHM_TYPO, otherwise NULL. */
+	struct typo_word *typo;
+	/*
+	 * The query packed as by match_initials(), and a mask of its bytes,
+	 * if it can also match the initials of strings, otherwise both 0.
+	 */
+	uint64_t initials;
+	uint64_t initials_mask;
+	const atomic_bool *cancel;
+};
+
+/* A range of bytes [start, end) of a string which matched a query. */
+struct match_span {
+	uint32_t start;
+	uint32_t end;
+};
+
+#define MATCH_MAX_SPANS 32
+
+/*
+ * The parts of a string which matched a query. This is small enough to live
+ * on the stack, so that highlighting matches doesn't need any allocations.
+ */
+struct match_spans {
+	size_t count;
+	struct match_span span[MATCH_MAX_SPANS];
+};
+
+int32_t match_words(
+		enum matching_algorithm algorithm,
+		const char *restrict patterns,
+		const char *restrict str,
+		struct match_spans *restrict spans);
+
+[[nodiscard("memory leaked")]]
+struct match_query match_query_create(
+		enum matching_algorithm algorithm,
+		const char *patterns);
+void match_query_destroy(struct match_query *restrict query);
+
+bool match_query_narrows(
+		const struct match_query *restrict parent,
+		const struct match_query *restrict child);
+
+bool match_query_cancelled(const struct match_query *restrict query);
+
+uint64_t match_mask(const char *folded);
+uint64_t match_initials(const char *str);
+
+int32_t match_query_score(
+		const struct match_query *restrict query,
+		const char *restrict str,
+		const char *restrict folded,
+		bool ascii);
+int32_t match_query_spans(
+		const struct match_query *restrict query,
+		const char *restrict str,
+		const char *restrict folded,
+		bool ascii,
+		struct match_spans *restrict spans);
+int32_t match_query_acronym(
+		const struct match_query *restrict query,
+		uint64_t initials);
+int32_t match_query_normal(
+		const struct match_query *restrict query,
+		const char *restrict str,
+		const char *restrict folded,
+		bool ascii);
+int32_t match_query_prefix(
+		const struct match_query *restrict query,
+		const char *restrict str,
+		const char *restrict folded,
+		bool ascii);
+int32_t match_query_fuzzy(
+		const struct match_query *restrict query,
+		const char *restrict str,
+		const char *restrict folded,
+		bool ascii);
+int32_t match_query_typo(
+		const struct match_query *restrict query,
+		const char *restrict str,
+		const char *restrict folded,
+		bool ascii);
 
 #endif /* MATCHING_H */
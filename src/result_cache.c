@@ -0,0 +1,155 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "result_cache.h"
+#include "xmalloc.h"
+
+static size_t results_bytes(const struct string_ref_vec *results)
+{
+	return results->count * sizeof(results->buf[0]);
+}
+
+static void entry_destroy(struct result_cache_entry *entry)
+{
+	free(entry->text);
+	match_query_destroy(&entry->query);
+	string_ref_vec_destroy(&entry->results);
+}
+
+/* Remove the i-th entry, moving the last one into its place. */
+static void remove_entry(struct result_cache *restrict cache, size_t i)
+{
+	struct result_cache_entry *entry = &cache->entries[i];
+	cache->bytes -= results_bytes(&entry->results);
+	entry_destroy(entry);
+	cache->count--;
+	if (i < cache->count) {
+		*entry = cache->entries[cache->count];
+	}
+}
+
+static void remove_least_recently_used(struct result_cache *restrict cache)
+{
+	size_t lru = 0;
+	for (size_t i = 1; i < cache->count; i++) {
+		if (cache->entries[i].last_used < cache->entries[lru].last_used) {
+			lru = i;
+		}
+	}
+	remove_entry(cache, lru);
+}
+
+void result_cache_destroy(struct result_cache *restrict cache)
+{
+	result_cache_clear(cache);
+}
+
+void result_cache_clear(struct result_cache *restrict cache)
+{
+	for (size_t i = 0; i < cache->count; i++) {
+		entry_destroy(&cache->entries[i]);
+	}
+	cache->count = 0;
+	cache->bytes = 0;
+}
+
+/*
+ * Return the cached results for text, or NULL if there aren't any.
+ * The returned vector is owned by the cache, so should be shared (see
+ * string_ref_vec_share()) to keep hold of it.
+ */
+struct string_ref_vec *result_cache_find(
+		struct result_cache *restrict cache,
+		const char *restrict text)
+{
+	for (size_t i = 0; i < cache->count; i++) {
+		struct result_cache_entry *entry = &cache->entries[i];
+		if (strcmp(entry->text, text) == 0) {
+			entry->last_used = ++cache->clock;
+			return &entry->results;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Return the smallest cached result set which is guaranteed to contain every
+ * match for query (see match_query_narrows()), or NULL if there isn't one.
+ */
+const struct string_ref_vec *result_cache_find_parent(
+		struct result_cache *restrict cache,
+		const struct match_query *restrict query)
+{
+	struct result_cache_entry *best = NULL;
+	for (size_t i = 0; i < cache->count; i++) {
+		struct result_cache_entry *entry = &cache->entries[i];
+		if (best != NULL && entry->results.count >= best->results.count) {
+			continue;
+		}
+		if (match_query_narrows(&entry->query, query)) {
+			best = entry;
+		}
+	}
+	if (best == NULL) {
+		return NULL;
+	}
+	best->last_used = ++cache->clock;
+	return &best->results;
+}
+
+/*
+ * Store results for text, sharing them rather than copying them, and evicting
+ * the least recently used entries to make room. Results too large to be worth
+ * keeping aren't stored.
+ */
+void result_cache_add(
+		struct result_cache *restrict cache,
+		enum matching_algorithm algorithm,
+		const char *restrict text,
+		struct string_ref_vec *restrict results)
+{
+	size_t bytes = results_bytes(results);
+	if (bytes > RESULT_CACHE_MAX_ENTRY_BYTES) {
+		return;
+	}
+	while (cache->count == RESULT_CACHE_SIZE
+			|| cache->bytes + bytes > RESULT_CACHE_MAX_BYTES) {
+		remove_least_recently_used(cache);
+	}
+	struct result_cache_entry *entry = &cache->entries[cache->count];
+	cache->count++;
+	cache->bytes += bytes;
+	entry->text = xstrdup(text);
+	entry->query = match_query_create(algorithm, text);
+	entry->results = string_ref_vec_share(results);
+	entry->last_used = ++cache->clock;
+}
+
+/*
+ * Bring every entry up to date after the strings in vec have been added to
+ * the end of the list that was searched, so that they don't have to be
+ * thrown away.
+ */
+void result_cache_extend(
+		struct result_cache *restrict cache,
+		const struct string_ref_vec *restrict vec)
+{
+	for (size_t i = 0; i < cache->count; i++) {
+		struct result_cache_entry *entry = &cache->entries[i];
+		struct string_ref_vec matches = string_ref_vec_filter(vec, &entry->query);
+		cache->bytes += results_bytes(&matches);
+		string_ref_vec_merge(&entry->results, &matches);
+		string_ref_vec_destroy(&matches);
+	}
+
+	/* Anything that's grown too large has to go. */
+	for (size_t i = cache->count; i > 0; i--) {
+		struct result_cache_entry *entry = &cache->entries[i - 1];
+		if (results_bytes(&entry->results) > RESULT_CACHE_MAX_ENTRY_BYTES) {
+			remove_entry(cache, i - 1);
+		}
+	}
+	while (cache->bytes > RESULT_CACHE_MAX_BYTES) {
+		remove_least_recently_used(cache);
+	}
+}
@@ -0,0 +1,58 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "matching.h"
+#include "string_vec.h"
+
+#define RESULT_CACHE_SIZE 16
+
+/*
+ * The most memory the cached results may take up in total, and the most any
+ * one set of them may. Short queries against huge lists match most of the
+ * list, and aren't worth keeping around.
+ */
+#define RESULT_CACHE_MAX_BYTES (64 * 1024 * 1024)
+#define RESULT_CACHE_MAX_ENTRY_BYTES (RESULT_CACHE_MAX_BYTES / 4)
+
+struct result_cache_entry {
+	char *text;
+	struct match_query query;
+	struct string_ref_vec results;
+	uint64_t last_used;
+};
+
+/*
+ * A small least-recently-used cache of search results, keyed by the input
+ * text that produced them. A zero-initialised cache is empty.
+ */
+struct result_cache {
+	size_t count;
+	size_t bytes;
+	uint64_t clock;
+	struct result_cache_entry entries[RESULT_CACHE_SIZE];
+};
+
+void result_cache_destroy(struct result_cache *restrict cache);
+void result_cache_clear(struct result_cache *restrict cache);
+
+struct string_ref_vec *result_cache_find(
+		struct result_cache *restrict cache,
+		const char *restrict text);
+
+const struct string_ref_vec *result_cache_find_parent(
+		struct result_cache *restrict cache,
+		const struct match_query *restrict query);
+
+void result_cache_add(
+		struct result_cache *restrict cache,
+		enum matching_algorithm algorithm,
+		const char *restrict text,
+		struct string_ref_vec *restrict results);
+
+void result_cache_extend(
+		struct result_cache *restrict cache,
+		const struct string_ref_vec *restrict vec);
+
+#endif /* RESULT_CACHE_H */
@@ -0,0 +1,241 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "simd.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+static const char *scalar_strchr(const char *s, char c)
+{
+	return strchr(s, c);
+}
+
+static const char *scalar_strstr(const char *haystack, const char *needle, size_t needle_len)
+{
+	return strstr(haystack, needle);
+}
+
+static bool scalar_is_ascii(const char *s)
+{
+	for (const unsigned char *c = (const unsigned char *)s; *c != '\0'; c++) {
+		if (*c >= 0x80) {
+			return false;
+		}
+	}
+	return true;
+}
+
+#ifdef HAVE_X86_SIMD
+
+/*
+ * All of the vector versions below work on aligned blocks, starting with the
+ * one containing the start of the string, and ignore any bits of each
+ * comparison mask that come before the start or after the terminating null.
+ * Aligned loads can never cross a page boundary, so although we may read a
+ * few bytes either side of the string, we'll never fault by doing so. These
+ * reads do upset AddressSanitizer though, so it's disabled for them.
+ *
+ * (end & -end) - 1 is a mask of all the bytes before the first null in a
+ * block, or every byte if there isn't one.
+ */
+
+[[gnu::no_sanitize_address]]
+static const char *sse2_strchr(const char *s, char c)
+{
+	const __m128i needle = _mm_set1_epi8(c);
+	const __m128i zero = _mm_setzero_si128();
+	const uintptr_t offset = (uintptr_t)s & 15;
+	const char *block = s - offset;
+	uint32_t skip = 0xFFFFu << offset;
+	while (true) {
+		__m128i v = _mm_load_si128((const __m128i *)block);
+		uint32_t found = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle)) & skip;
+		uint32_t end = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) & skip;
+		found &= (end & -end) - 1;
+		if (found) {
+			return block + __builtin_ctz(found);
+		}
+		if (end) {
+			return NULL;
+		}
+		skip = 0xFFFFu;
+		block += 16;
+	}
+}
+
+/*
+ * Find candidate positions where both the first and second bytes of needle
+ * match, and check just those properly. The last byte of a block doesn't know
+ * what follows it, so it's always a candidate if its first byte matches.
+ */
+[[gnu::no_sanitize_address]]
+static const char *sse2_strstr(const char *haystack, const char *needle, size_t needle_len)
+{
+	if (needle_len == 0) {
+		return haystack;
+	}
+	if (needle_len == 1) {
+		return sse2_strchr(haystack, needle[0]);
+	}
+	const __m128i first = _mm_set1_epi8(needle[0]);
+	const __m128i second = _mm_set1_epi8(needle[1]);
+	const __m128i zero = _mm_setzero_si128();
+	const uintptr_t offset = (uintptr_t)haystack & 15;
+	const char *block = haystack - offset;
+	uint32_t skip = 0xFFFFu << offset;
+	while (true) {
+		__m128i v = _mm_load_si128((const __m128i *)block);
+		uint32_t eq1 = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, first));
+		uint32_t eq2 = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, second));
+		uint32_t end = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) & skip;
+		uint32_t candidates = eq1 & ((eq2 >> 1) | 0x8000u) & skip & ((end & -end) - 1);
+		while (candidates) {
+			const char *c = block + __builtin_ctz(candidates);
+			if (strncmp(c + 1, needle + 1, needle_len - 1) == 0) {
+				return c;
+			}
+			candidates &= candidates - 1;
+		}
+		if (end) {
+			return NULL;
+		}
+		skip = 0xFFFFu;
+		block += 16;
+	}
+}
+
+[[gnu::no_sanitize_address]]
+static bool sse2_is_ascii(const char *s)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const uintptr_t offset = (uintptr_t)s & 15;
+	const char *block = s - offset;
+	uint32_t skip = 0xFFFFu << offset;
+	while (true) {
+		__m128i v = _mm_load_si128((const __m128i *)block);
+		uint32_t high = (uint32_t)_mm_movemask_epi8(v) & skip;
+		uint32_t end = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) & skip;
+		if (high & ((end & -end) - 1)) {
+			return false;
+		}
+		if (end) {
+			return true;
+		}
+		skip = 0xFFFFu;
+		block += 16;
+	}
+}
+
+[[gnu::target("avx2"), gnu::no_sanitize_address]]
+static const char *avx2_strchr(const char *s, char c)
+{
+	const __m256i needle = _mm256_set1_epi8(c);
+	const __m256i zero = _mm256_setzero_si256();
+	const uintptr_t offset = (uintptr_t)s & 31;
+	const char *block = s - offset;
+	uint32_t skip = 0xFFFFFFFFu << offset;
+	while (true) {
+		__m256i v = _mm256_load_si256((const __m256i *)block);
+		uint32_t found = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle)) & skip;
+		uint32_t end = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero)) & skip;
+		found &= (end & -end) - 1;
+		if (found) {
+			return block + __builtin_ctz(found);
+		}
+		if (end) {
+			return NULL;
+		}
+		skip = 0xFFFFFFFFu;
+		block += 32;
+	}
+}
+
+[[gnu::target("avx2"), gnu::no_sanitize_address]]
+static const char *avx2_strstr(const char *haystack, const char *needle, size_t needle_len)
+{
+	if (needle_len == 0) {
+		return haystack;
+	}
+	if (needle_len == 1) {
+		return avx2_strchr(haystack, needle[0]);
+	}
+	const __m256i first = _mm256_set1_epi8(needle[0]);
+	const __m256i second = _mm256_set1_epi8(needle[1]);
+	const __m256i zero = _mm256_setzero_si256();
+	const uintptr_t offset = (uintptr_t)haystack & 31;
+	const char *block = haystack - offset;
+	uint32_t skip = 0xFFFFFFFFu << offset;
+	while (true) {
+		__m256i v = _mm256_load_si256((const __m256i *)block);
+		uint32_t eq1 = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, first));
+		uint32_t eq2 = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, second));
+		uint32_t end = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero)) & skip;
+		uint32_t candidates = eq1 & ((eq2 >> 1) | 0x80000000u) & skip & ((end & -end) - 1);
+		while (candidates) {
+			const char *c = block + __builtin_ctz(candidates);
+			if (strncmp(c + 1, needle + 1, needle_len - 1) == 0) {
+				return c;
+			}
+			candidates &= candidates - 1;
+		}
+		if (end) {
+			return NULL;
+		}
+		skip = 0xFFFFFFFFu;
+		block += 32;
+	}
+}
+
+[[gnu::target("avx2"), gnu::no_sanitize_address]]
+static bool avx2_is_ascii(const char *s)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const uintptr_t offset = (uintptr_t)s & 31;
+	const char *block = s - offset;
+	uint32_t skip = 0xFFFFFFFFu << offset;
+	while (true) {
+		__m256i v = _mm256_load_si256((const __m256i *)block);
+		uint32_t high = (uint32_t)_mm256_movemask_epi8(v) & skip;
+		uint32_t end = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero)) & skip;
+		if (high & ((end & -end) - 1)) {
+			return false;
+		}
+		if (end) {
+			return true;
+		}
+		skip = 0xFFFFFFFFu;
+		block += 32;
+	}
+}
+
+#endif /* HAVE_X86_SIMD */
+
+const char *(*simd_strchr)(const char *s, char c) = scalar_strchr;
+const char *(*simd_strstr)(const char *haystack, const char *needle, size_t needle_len) = scalar_strstr;
+bool (*simd_is_ascii)(const char *s) = scalar_is_ascii;
+
+/*
+ * Pick the fastest versions the CPU supports. This runs before main(), so
+ * the pointers never change once anything could be using them.
+ */
+[[gnu::constructor]]
+static void simd_init(void)
+{
+#ifdef HAVE_X86_SIMD
+	/* SSE2 is always available on x86-64. */
+	simd_strchr = sse2_strchr;
+	simd_strstr = sse2_strstr;
+	simd_is_ascii = sse2_is_ascii;
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		simd_strchr = avx2_strchr;
+		simd_strstr = avx2_strstr;
+		simd_is_ascii = avx2_is_ascii;
+	}
+#endif
+}
@@ -0,0 +1,36 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Byte-wise string scanning, with SSE2 and AVX2 versions selected at runtime
+ * on x86-64, and plain C versions everywhere else.
+ *
+ * These only compare bytes, so they're mostly useful on strings that have
+ * already been case-folded with utf8_fold().
+ *
+ * They're called for every string that's searched, so rather than checking
+ * which version to use each time, these pointers are set to the best one
+ * once, before main() runs.
+ */
+
+/*
+ * Return a pointer to the first occurrence of the byte c in s, or NULL.
+ * c must not be '\0'.
+ */
+extern const char *(*simd_strchr)(const char *s, char c);
+
+/*
+ * Return a pointer to the first occurrence of needle (of length needle_len)
+ * in haystack, or NULL.
+ */
+extern const char *(*simd_strstr)(const char *haystack, const char *needle, size_t needle_len);
+
+/*
+ * Return whether s consists entirely of 7-bit ASCII.
+ */
+extern bool (*simd_is_ascii)(const char *s);
+
+#endif /* SIMD_H */
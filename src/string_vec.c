@@ -5,12 +5,32 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include "arena.h"
 #include "history.h"
+#include "log.h"
 #include "matching.h"
+#include "simd.h"
 #include "string_vec.h"
 #include "unicode.h"
 #include "xmalloc.h"
 
+/*
+ * How many filter results to sort at a time. Usually, no more than this will
+ * ever be displayed, so the rest never need sorting.
+ */
+#define RESULTS_SORT_CHUNK 128
+
+/* How many strings to filter between checks for cancellation. */
+#define FILTER_CANCEL_INTERVAL 4096
+
+/* The initial number of slots in a line_set, which must be a power of 2. */
+#define LINE_SET_MIN_SIZE 1024
+
+#undef MAX
+#undef MIN
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
 static int cmpstringp(const void *restrict a, const void *restrict b)
 {
 	struct scored_string *restrict str1 = (struct scored_string *)a;
@@ -28,22 +48,20 @@ static int cmpstringp(const void *restrict a, const void *restrict b)
 	return strcmp(str1->string, str2->string);
 }
 
-static int cmpscorep(const void *restrict a, const void *restrict b)
-{
-	struct scored_string *restrict str1 = (struct scored_string *)a;
-	struct scored_string *restrict str2 = (struct scored_string *)b;
-
-	int hist_diff = str2->history_score - str1->history_score;
-	int search_diff = str2->search_score - str1->search_score;
-	return hist_diff + search_diff;
-}
-
+/*
+ * Order by history score, highest first, and then by index, so that strings
+ * with the same score stay in their original order, which qsort() alone
+ * wouldn't guarantee.
+ */
 static int cmphistoryp(const void *restrict a, const void *restrict b)
 {
-	struct scored_string *restrict str1 = (struct scored_string *)a;
-	struct scored_string *restrict str2 = (struct scored_string *)b;
+	const struct scored_string_ref *restrict str1 = a;
+	const struct scored_string_ref *restrict str2 = b;
 
-	return str2->history_score - str1->history_score;
+	if (str1->history_score != str2->history_score) {
+		return str1->history_score < str2->history_score ? 1 : -1;
+	}
+	return (str1->index > str2->index) - (str1->index < str2->index);
 }
 
 struct string_vec string_vec_create(void)
@@ -62,21 +80,28 @@ struct string_ref_vec string_ref_vec_create(void)
 		.count = 0,
 		.size = 128,
 		.buf = xcalloc(128, sizeof(*vec.buf)),
+		.sorted = SIZE_MAX,
 	};
 	return vec;
 }
 
 void string_vec_destroy(struct string_vec *restrict vec)
 {
-	for (size_t i = 0; i < vec->count; i++) {
-		free(vec->buf[i].string);
-	}
 	free(vec->buf);
+	arena_destroy(&vec->strings);
 }
 
 void string_ref_vec_destroy(struct string_ref_vec *restrict vec)
 {
-	free(vec->buf);
+	if (vec->refs == NULL || atomic_fetch_sub(vec->refs, 1) == 1) {
+		free(vec->buf);
+		free(vec->refs);
+	}
+	for (size_t i = 0; i < vec->num_buffers; i++) {
+		free(vec->buffers[i]);
+	}
+	free(vec->buffers);
+	free(vec->masks);
 }
 
 struct string_ref_vec string_ref_vec_copy(const struct string_ref_vec *restrict vec)
@@ -85,29 +110,83 @@ struct string_ref_vec string_ref_vec_copy(const struct string_ref_vec *restrict
 		.count = vec->count,
 		.size = vec->size,
 		.buf = xcalloc(vec->size, sizeof(*copy.buf)),
+		.sorted = vec->sorted,
 	};
 
-	for (size_t i = 0; i < vec->count; i++) {
-		copy.buf[i].string = vec->buf[i].string;
-		copy.buf[i].search_score = vec->buf[i].search_score;
-		copy.buf[i].history_score = vec->buf[i].history_score;
-	}
+	memcpy(copy.buf, vec->buf, vec->count * sizeof(*copy.buf));
 
 	return copy;
 }
 
+/*
+ * Return a vector with the same entries as vec, without copying them. They're
+ * freed once every vector sharing them has been destroyed, and this is safe to
+ * call from one thread while another reads or destroys a vector sharing
+ * them. The storage of vec itself (buffers and masks) isn't shared, so vec
+ * should be a plain list of references, such as a filter result.
+ */
+struct string_ref_vec string_ref_vec_share(struct string_ref_vec *restrict vec)
+{
+	if (vec->refs == NULL) {
+		vec->refs = xmalloc(sizeof(*vec->refs));
+		atomic_init(vec->refs, 1);
+	}
+	atomic_fetch_add(vec->refs, 1);
+	return (struct string_ref_vec){
+		.count = vec->count,
+		.size = vec->size,
+		.buf = vec->buf,
+		.sorted = vec->sorted,
+		.refs = vec->refs
+	};
+}
+
+/*
+ * Give vec its own copy of any entries it shares with other vectors, so that
+ * it can change them.
+ */
+static void unshare(struct string_ref_vec *restrict vec)
+{
+	if (vec->refs == NULL) {
+		return;
+	}
+	if (atomic_load(vec->refs) == 1) {
+		/* Everyone else has let go, so they're all ours. */
+		free(vec->refs);
+		vec->refs = NULL;
+		return;
+	}
+	struct scored_string_ref *buf = xmalloc(vec->size * sizeof(*buf));
+	memcpy(buf, vec->buf, vec->count * sizeof(*buf));
+	/*
+	 * The others may have let go while we were copying, in which case
+	 * the old entries are ours to free.
+	 */
+	if (atomic_fetch_sub(vec->refs, 1) == 1) {
+		free(vec->buf);
+		free(vec->refs);
+	}
+	vec->buf = buf;
+	vec->refs = NULL;
+}
+
 void string_vec_add(struct string_vec *restrict vec, const char *restrict str)
 {
-	if (!utf8_validate(str)) {
+	/* Pure ASCII is always valid, and never changed by normalization. */
+	bool ascii = simd_is_ascii(str);
+	if (!ascii && !utf8_validate(str)) {
 		return;
 	}
 	if (vec->count == vec->size) {
 		vec->size *= 2;
 		vec->buf = xrealloc(vec->buf, vec->size * sizeof(vec->buf[0]));
 	}
-	vec->buf[vec->count].string = utf8_normalize(str);
-	if (vec->buf[vec->count].string == NULL) {
-		vec->buf[vec->count].string = xstrdup(str);
+	char *normalized = ascii ? NULL : utf8_normalize(str);
+	if (normalized != NULL) {
+		vec->buf[vec->count].string = arena_strdup(&vec->strings, normalized);
+		free(normalized);
+	} else {
+		vec->buf[vec->count].string = arena_strdup(&vec->strings, str);
 	}
 	vec->buf[vec->count].search_score = 0;
 	vec->buf[vec->count].history_score = 0;
@@ -123,6 +202,11 @@ void string_ref_vec_add(struct string_ref_vec *restrict vec, char *restrict str)
 	vec->buf[vec->count].string = str;
 	vec->buf[vec->count].search_score = 0;
 	vec->buf[vec->count].history_score = 0;
+	vec->buf[vec->count].folded = NULL;
+	vec->buf[vec->count].mask = 0;
+	vec->buf[vec->count].initials = 0;
+	vec->buf[vec->count].index = vec->count;
+	vec->buf[vec->count].ascii = false;
 	vec->count++;
 }
 
@@ -147,11 +231,187 @@ void string_ref_vec_history_sort(struct string_ref_vec *restrict vec, struct his
 		if (res == NULL) {
 			continue;
 		}
-		res->history_score = history->buf[i].run_count;
+		/* Add to any score from duplicates (see line_set). */
+		res->history_score += history->buf[i].run_count;
 	}
 	g_hash_table_unref(hash);
 
 	qsort(vec->buf, vec->count, sizeof(vec->buf[0]), cmphistoryp);
+	if (vec->masks != NULL) {
+		for (size_t i = 0; i < vec->count; i++) {
+			vec->masks[i] = vec->buf[i].mask;
+		}
+	}
+}
+
+/*
+ * Results are ranked by a packed 64-bit key, smallest first. The high 32 bits
+ * hold the combined history and search score, saturated to 32 bits and
+ * flipped so that higher scores give smaller keys, and the low 32 bits hold
+ * the string's index, so that equal scores keep their original order. As
+ * indices are unique, this gives a total order, which doesn't depend on the
+ * order that results were found in.
+ */
+struct rank_key {
+	uint64_t key;
+	size_t pos;
+};
+
+static uint64_t rank_key(const struct scored_string_ref *str)
+{
+	int64_t score = (int64_t)str->history_score + str->search_score;
+	if (score > INT32_MAX) {
+		score = INT32_MAX;
+	} else if (score < INT32_MIN) {
+		score = INT32_MIN;
+	}
+	uint64_t rank = (uint64_t)(INT32_MAX - score);
+	return rank << 32 | str->index;
+}
+
+/*
+ * Rearrange keys so that its first k entries are the k smallest, in no
+ * particular order, by quickselect.
+ */
+static void select_smallest(struct rank_key *keys, size_t count, size_t k)
+{
+	size_t lo = 0;
+	size_t hi = count;
+	while (hi - lo > 1) {
+		uint64_t pivot = keys[lo + (hi - lo) / 2].key;
+		size_t lt = lo;
+		size_t gt = hi;
+		size_t i = lo;
+		while (i < gt) {
+			struct rank_key tmp = keys[i];
+			if (tmp.key < pivot) {
+				keys[i++] = keys[lt];
+				keys[lt++] = tmp;
+			} else if (tmp.key > pivot) {
+				keys[i] = keys[--gt];
+				keys[gt] = tmp;
+			} else {
+				i++;
+			}
+		}
+		/*
+		 * Now [lo, lt) are less than the pivot, [lt, gt) equal to it,
+		 * and [gt, hi) greater.
+		 */
+		if (k < lt) {
+			hi = lt;
+		} else if (k > gt) {
+			lo = gt;
+		} else {
+			return;
+		}
+	}
+}
+
+/*
+ * Sort keys with an LSD radix sort, a byte at a time. Passes where every key
+ * has the same byte (e.g. the high bytes of the score, which are usually all
+ * the same) are skipped.
+ */
+static void radix_sort(struct rank_key *keys, size_t count)
+{
+	if (count < 2) {
+		return;
+	}
+	size_t counts[8][256] = { 0 };
+	for (size_t i = 0; i < count; i++) {
+		for (size_t d = 0; d < 8; d++) {
+			counts[d][(keys[i].key >> (8 * d)) & 0xFF]++;
+		}
+	}
+
+	struct rank_key *tmp = xmalloc(count * sizeof(*tmp));
+	struct rank_key *src = keys;
+	struct rank_key *dst = tmp;
+	for (size_t d = 0; d < 8; d++) {
+		size_t shift = 8 * d;
+		if (counts[d][(src[0].key >> shift) & 0xFF] == count) {
+			continue;
+		}
+		size_t offset = 0;
+		for (size_t b = 0; b < 256; b++) {
+			size_t n = counts[d][b];
+			counts[d][b] = offset;
+			offset += n;
+		}
+		for (size_t i = 0; i < count; i++) {
+			dst[counts[d][(src[i].key >> shift) & 0xFF]++] = src[i];
+		}
+		struct rank_key *swap = src;
+		src = dst;
+		dst = swap;
+	}
+	if (src != keys) {
+		memcpy(keys, src, count * sizeof(*keys));
+	}
+	free(tmp);
+}
+
+/*
+ * Only sort the first few entries of a list of filter results.
+ *
+ * Sorting every match of a short query against a long list is slow, and
+ * usually only the first page of results is ever displayed, so the rest are
+ * left unsorted until string_ref_vec_sort_until() is called for them.
+ */
+void string_ref_vec_sort_partial(struct string_ref_vec *restrict vec)
+{
+	vec->sorted = 0;
+	string_ref_vec_sort_until(vec, 1);
+}
+
+/*
+ * Make sure at least the first n entries of vec are in their final order.
+ * To avoid doing this one entry at a time, at least a chunk more than was
+ * previously sorted is sorted at once.
+ */
+void string_ref_vec_sort_until(struct string_ref_vec *restrict vec, size_t n)
+{
+	if (n <= vec->sorted) {
+		return;
+	}
+	if (vec->sorted >= vec->count) {
+		vec->sorted = SIZE_MAX;
+		return;
+	}
+	unshare(vec);
+	size_t target = MAX(n, MAX(2 * vec->sorted, vec->sorted + RESULTS_SORT_CHUNK));
+	struct scored_string_ref *rest = &vec->buf[vec->sorted];
+	size_t count = vec->count - vec->sorted;
+	size_t num_to_sort = count;
+	if (target < vec->count) {
+		num_to_sort = target - vec->sorted;
+	}
+
+	struct rank_key *keys = xmalloc(count * sizeof(*keys));
+	for (size_t i = 0; i < count; i++) {
+		keys[i].key = rank_key(&rest[i]);
+		keys[i].pos = i;
+	}
+	if (num_to_sort < count) {
+		select_smallest(keys, count, num_to_sort);
+	}
+	radix_sort(keys, num_to_sort);
+
+	/* Rearrange the results to match their keys. */
+	struct scored_string_ref *sorted = xmalloc(count * sizeof(*sorted));
+	for (size_t i = 0; i < count; i++) {
+		sorted[i] = rest[keys[i].pos];
+	}
+	memcpy(rest, sorted, count * sizeof(*rest));
+	free(sorted);
+	free(keys);
+
+	if (num_to_sort == count) {
+		vec->sorted = SIZE_MAX;
+	} else {
+		vec->sorted = target;
+	}
 }
 
 void string_vec_uniq(struct string_vec *restrict vec)
@@ -159,7 +419,7 @@ void string_vec_uniq(struct string_vec *restrict vec)
 	size_t count = vec->count;
 	for (size_t i = 1; i < vec->count; i++) {
 		if (!strcmp(vec->buf[i].string, vec->buf[i-1].string)) {
-			free(vec->buf[i-1].string);
+			/* The string itself stays in the arena. */
 			vec->buf[i-1].string = NULL;
 			count--;
 		}
@@ -178,38 +438,537 @@ struct scored_string_ref *string_ref_vec_find_sorted(struct string_ref_vec *rest
 	return bsearch(&str, vec->buf, vec->count, sizeof(vec->buf[0]), cmpstringp);
 }
 
+/*
+ * The body of string_ref_vec_filter(), which is always inlined with a
+ * constant match function, so that we get a specialised loop for each
+ * algorithm rather than choosing the algorithm again for every string.
+ */
+[[gnu::always_inline]]
+static inline void filter_with(
+		struct string_ref_vec *restrict filt,
+		const struct string_ref_vec *restrict vec,
+		const struct match_query *restrict query,
+		int32_t (*match)(
+			const struct match_query *restrict query,
+			const char *restrict str,
+			const char *restrict folded,
+			bool ascii))
+{
+	const uint64_t mask = query->mask;
+	const bool acronyms = query->initials_mask != 0;
+	const uint64_t *masks = vec->masks;
+	for (size_t i = 0; i < vec->count; i++) {
+		if (i % FILTER_CANCEL_INTERVAL == 0 && match_query_cancelled(query)) {
+			return;
+		}
+		uint64_t str_mask = masks != NULL ? masks[i] : vec->buf[i].mask;
+		if ((str_mask & mask) != mask) {
+			continue;
+		}
+		int32_t search_score = match(
+				query,
+				vec->buf[i].string,
+				vec->buf[i].folded,
+				vec->buf[i].ascii);
+		if (acronyms) {
+			search_score = MAX(
+					search_score,
+					match_query_acronym(query, vec->buf[i].initials));
+		}
+		if (search_score != INT32_MIN) {
+			if (filt->count == filt->size) {
+				filt->size *= 2;
+				filt->buf = xrealloc(filt->buf, filt->size * sizeof(filt->buf[0]));
+			}
+			filt->buf[filt->count] = vec->buf[i];
+			filt->buf[filt->count].search_score = search_score;
+			filt->count++;
+		}
+	}
+}
+
+/*
+ * Append the strings in vec that match query to filt, in order.
+ */
+static void filter_into(
+		struct string_ref_vec *restrict filt,
+		const struct string_ref_vec *restrict vec,
+		const struct match_query *restrict query)
+{
+	switch (query->algorithm) {
+		case MATCHING_ALGORITHM_NORMAL:
+			filter_with(filt, vec, query, match_query_normal);
+			break;
+		case MATCHING_ALGORITHM_PREFIX:
+			filter_with(filt, vec, query, match_query_prefix);
+			break;
+		case MATCHING_ALGORITHM_FUZZY:
+			filter_with(filt, vec, query, match_query_fuzzy);
+			break;
+		case MATCHING_ALGORITHM_TYPO:
+			filter_with(filt, vec, query, match_query_typo);
+			break;
+	}
+}
+
 struct string_ref_vec string_ref_vec_filter(
 		const struct string_ref_vec *restrict vec,
-		const char *restrict substr,
-		enum matching_algorithm algorithm)
+		const struct match_query *restrict query)
 {
-	if (substr[0] == '\0') {
+	if (query->count == 0) {
 		return string_ref_vec_copy(vec);
 	}
 	struct string_ref_vec filt = string_ref_vec_create();
-	for (size_t i = 0; i < vec->count; i++) {
-		int32_t search_score;
-		search_score = match_words(algorithm, substr, vec->buf[i].string);
-		if (search_score != INT32_MIN) {
-			string_ref_vec_add(&filt, vec->buf[i].string);
-			filt.buf[filt.count - 1].search_score = search_score;
-			filt.buf[filt.count - 1].history_score = vec->buf[i].history_score;
-		}
+	filter_into(&filt, vec, query);
+	/* Sort the best results by their search score. */
+	string_ref_vec_sort_partial(&filt);
+	return filt;
+}
+
+struct parallel_filter {
+	const struct string_ref_vec *vec;
+	const struct match_query *query;
+	size_t chunk_size;
+	struct string_ref_vec *results;
+};
+
+static void parallel_filter_job(void *arg, size_t job)
+{
+	struct parallel_filter *data = arg;
+	size_t start = job * data->chunk_size;
+	size_t end = start + data->chunk_size;
+	if (start > data->vec->count) {
+		start = data->vec->count;
+	}
+	if (end > data->vec->count) {
+		end = data->vec->count;
+	}
+	/* A view of just this job's chunk of the vector. */
+	struct string_ref_vec chunk = {
+		.count = end - start,
+		.size = end - start,
+		.buf = data->vec->buf + start,
+		.masks = data->vec->masks ? data->vec->masks + start : NULL
+	};
+	data->results[job] = string_ref_vec_create();
+	filter_into(&data->results[job], &chunk, data->query);
+}
+
+/*
+ * Like string_ref_vec_filter(), but split the work between the threads of
+ * pool. Each thread filters a few contiguous chunks of vec into its own
+ * vector, and these are then joined in order before sorting, so that the
+ * result is exactly the same as the serial version.
+ */
+struct string_ref_vec string_ref_vec_filter_parallel(
+		const struct string_ref_vec *restrict vec,
+		const struct match_query *restrict query,
+		struct worker_pool *pool)
+{
+	if (query->count == 0) {
+		return string_ref_vec_copy(vec);
+	}
+
+	/*
+	 * Use a few chunks per thread, so that a thread which gets an
+	 * unusually slow chunk doesn't hold everyone else up.
+	 */
+	size_t num_jobs = (pool->count + 1) * 4;
+	struct parallel_filter data = {
+		.vec = vec,
+		.query = query,
+		.chunk_size = (vec->count + num_jobs - 1) / num_jobs,
+		.results = xcalloc(num_jobs, sizeof(*data.results))
+	};
+	worker_pool_run(pool, parallel_filter_job, &data, num_jobs);
+
+	size_t count = 0;
+	for (size_t i = 0; i < num_jobs; i++) {
+		count += data.results[i].count;
+	}
+	struct string_ref_vec filt = string_ref_vec_create();
+	if (count > filt.size) {
+		filt.size = count;
+		filt.buf = xrealloc(filt.buf, filt.size * sizeof(filt.buf[0]));
 	}
-	/* Sort the results by their search score. */
-	qsort(filt.buf, filt.count, sizeof(filt.buf[0]), cmpscorep);
+	for (size_t i = 0; i < num_jobs; i++) {
+		memcpy(&filt.buf[filt.count],
+				data.results[i].buf,
+				data.results[i].count * sizeof(filt.buf[0]));
+		filt.count += data.results[i].count;
+		string_ref_vec_destroy(&data.results[i]);
+	}
+	free(data.results);
+
+	string_ref_vec_sort_partial(&filt);
 	return filt;
 }
 
-struct string_ref_vec string_ref_vec_from_buffer(char *buffer)
+/*
+ * Add the results of filtering some more strings to the earlier results of
+ * the same query, keeping them in the order described in string_vec.h.
+ *
+ * Both lists must have been produced by the same query, and more must only
+ * contain strings with larger indices than those already in results (e.g.
+ * lines read after the earlier results were found).
+ */
+void string_ref_vec_merge(
+		struct string_ref_vec *restrict results,
+		const struct string_ref_vec *restrict more)
 {
-	struct string_ref_vec vec = string_ref_vec_create();
+	if (more->count == 0) {
+		return;
+	}
+	unshare(results);
+	size_t count = results->count;
+	size_t sorted = MIN(results->sorted, count);
+
+	/*
+	 * If everything new ranks after the sorted part of results, it can
+	 * just go on the end, which is by far the most common case when
+	 * results are sorted by index alone (e.g. for an empty query).
+	 */
+	bool after = true;
+	if (sorted > 0) {
+		uint64_t last = rank_key(&results->buf[sorted - 1]);
+		for (size_t i = 0; i < more->count; i++) {
+			if (rank_key(&more->buf[i]) < last) {
+				after = false;
+				break;
+			}
+		}
+	}
+
+	if (results->count + more->count > results->size) {
+		results->size = MAX(2 * results->size, results->count + more->count);
+		results->buf = xrealloc(results->buf, results->size * sizeof(results->buf[0]));
+	}
+	memcpy(&results->buf[count], more->buf, more->count * sizeof(more->buf[0]));
+	results->count += more->count;
+
+	if (!after) {
+		string_ref_vec_sort_partial(results);
+	} else if (results->sorted >= count) {
+		/* The new entries follow on from the old ones. */
+		if (more->sorted == SIZE_MAX) {
+			results->sorted = SIZE_MAX;
+		} else {
+			results->sorted = count + more->sorted;
+		}
+	}
+}
+
+/* Where a line's normalized copy is, until it can be pointed to. */
+struct moved_line {
+	size_t index;
+	size_t offset;
+};
+
+static void keep_buffer(struct string_ref_vec *restrict vec, char *buffer)
+{
+	vec->buffers = xrealloc(vec->buffers, (vec->num_buffers + 1) * sizeof(*vec->buffers));
+	vec->buffers[vec->num_buffers] = buffer;
+	vec->num_buffers++;
+}
+
+/*
+ * Each slot of a line_set holds a line, as it was read, with its hash,
+ * position in the vector and the number of copies of it that were skipped.
+ * Empty slots have a NULL line.
+ */
+struct line_set_slot {
+	const char *line;
+	uint32_t hash;
+	uint32_t pos;
+	uint32_t duplicates;
+};
 
-	char *saveptr = NULL;
-	char *line = strtok_r(buffer, "\n", &saveptr);
-	while (line != NULL) {
-		string_ref_vec_add(&vec, line);
-		line = strtok_r(NULL, "\n", &saveptr);
+void line_set_destroy(struct line_set *set)
+{
+	free(set->slots);
+	*set = (struct line_set){ 0 };
+}
+
+/*
+ * If set->count_duplicates is set, add the number of skipped copies of each
+ * line to the history_score of the copy that was kept in vec. This is only
+ * done once all the lines have been added, so that the scores of any copies
+ * of the strings made before then (e.g. search results) aren't left out of
+ * date, and must be done before vec is reordered.
+ */
+void line_set_count_duplicates(
+		const struct line_set *restrict set,
+		struct string_ref_vec *restrict vec)
+{
+	if (!set->count_duplicates) {
+		return;
 	}
+	for (size_t i = 0; i < set->size; i++) {
+		const struct line_set_slot *slot = &set->slots[i];
+		if (slot->line == NULL || slot->duplicates == 0) {
+			continue;
+		}
+		struct scored_string_ref *str = &vec->buf[slot->pos];
+		int64_t score = (int64_t)str->history_score + slot->duplicates;
+		str->history_score = MIN(score, INT32_MAX);
+	}
+}
+
+/*
+ * Hash the first len bytes of str, 8 at a time. This only has to spread lines
+ * out over a line_set's slots, not stand up to deliberate collisions.
+ */
+static uint32_t hash_line(const char *str, size_t len)
+{
+	const uint64_t k = 0x9e3779b97f4a7c15;
+	uint64_t h = len * k;
+	uint64_t word;
+	while (len >= sizeof(word)) {
+		memcpy(&word, str, sizeof(word));
+		h = (h ^ word) * k;
+		h ^= h >> 32;
+		str += sizeof(word);
+		len -= sizeof(word);
+	}
+	word = 0;
+	memcpy(&word, str, len);
+	h = (h ^ word) * k;
+	return h ^ (h >> 32);
+}
+
+static void line_set_grow(struct line_set *set)
+{
+	size_t size = MAX(2 * set->size, LINE_SET_MIN_SIZE);
+	struct line_set_slot *slots = xcalloc(size, sizeof(*slots));
+	for (size_t i = 0; i < set->size; i++) {
+		if (set->slots[i].line == NULL) {
+			continue;
+		}
+		size_t j = set->slots[i].hash & (size - 1);
+		while (slots[j].line != NULL) {
+			j = (j + 1) & (size - 1);
+		}
+		slots[j] = set->slots[i];
+	}
+	free(set->slots);
+	set->slots = slots;
+	set->size = size;
+}
+
+/*
+ * Look for the len byte, nul-terminated line in set, and return true if it
+ * isn't there, in which case it's recorded as being at the end of vec, where
+ * it's about to be added. Otherwise, another copy of it is counted.
+ */
+static bool line_set_add(
+		struct line_set *restrict set,
+		struct string_ref_vec *restrict vec,
+		const char *line,
+		size_t len)
+{
+	/* Keep the table at most half full, so that probes stay short. */
+	if (2 * (set->count + 1) > set->size) {
+		line_set_grow(set);
+	}
+
+	uint32_t hash = hash_line(line, len);
+	size_t i = hash & (set->size - 1);
+	while (set->slots[i].line != NULL) {
+		struct line_set_slot *slot = &set->slots[i];
+		if (slot->hash == hash && strcmp(slot->line, line) == 0) {
+			if (slot->duplicates < UINT32_MAX) {
+				slot->duplicates++;
+			}
+			return false;
+		}
+		i = (i + 1) & (set->size - 1);
+	}
+	set->slots[i] = (struct line_set_slot){
+		.line = line,
+		.hash = hash,
+		.pos = vec->count
+	};
+	set->count++;
+	return true;
+}
+
+/*
+ * Normalize the line at vec->buf[i], if it needs it, by appending a
+ * normalized copy of it to *buf. As that may move, the copy's offset in it is
+ * stored in *moved for now. Returns false if the line isn't valid UTF-8.
+ */
+static bool normalize_line(
+		struct string_ref_vec *restrict vec,
+		size_t i,
+		char **buf,
+		size_t *len,
+		size_t *size,
+		struct moved_line **moved,
+		size_t *num_moved)
+{
+	const char *line = vec->buf[i].string;
+	if (!utf8_validate(line)) {
+		return false;
+	}
+	char *normalized = utf8_normalize(line);
+	if (normalized == NULL || strcmp(normalized, line) == 0) {
+		free(normalized);
+		return true;
+	}
+
+	size_t normalized_len = strlen(normalized) + 1;
+	if (*len + normalized_len > *size) {
+		*size = MAX(2 * *size, *len + normalized_len);
+		*buf = xrealloc(*buf, *size);
+	}
+	memcpy(&(*buf)[*len], normalized, normalized_len);
+	free(normalized);
+
+	if (*num_moved % 1024 == 0) {
+		*moved = xrealloc(*moved, (*num_moved + 1024) * sizeof(**moved));
+	}
+	(*moved)[*num_moved] = (struct moved_line){ .index = i, .offset = *len };
+	(*num_moved)++;
+	*len += normalized_len;
+	return true;
+}
+
+/*
+ * Split the first len bytes of buffer into lines separated by delimiter
+ * (skipping empty ones), add them to vec, and build the folded copy, mask and
+ * initials of each line now, so that we don't have to do so again for each
+ * search. buffer[len] must be a nul byte, and lines are terminated in place.
+ *
+ * If normalize is set, lines are also normalized (see utf8_normalize()) as
+ * they're found. Pure ASCII lines never need it, and most input is, so this
+ * is only done for the rest, whose normalized copies are stored separately.
+ *
+ * Lines with invalid UTF-8 are left exactly as they were read, as they're
+ * what gets printed, and may well be file names. Only what's derived from
+ * them is made safe: utf8_fold() replaces each invalid byte with U+FFFD, and
+ * matching decodes the line the same way.
+ *
+ * If unique isn't NULL, lines that are already in it are skipped, so that only
+ * the first copy of each is added. This compares lines as they were read, so
+ * happens before they're normalized, which saves normalizing the copies.
+ *
+ * All the buffers this creates are added to vec's own. ASCII lines fold to
+ * copies of the same length, so only the rest need the folded buffer to be
+ * sized for the worst case.
+ */
+static void add_lines(
+		struct string_ref_vec *restrict vec,
+		char *buffer,
+		size_t len,
+		char delimiter,
+		bool normalize,
+		struct line_set *unique)
+{
+	size_t start = vec->count;
+	size_t size = vec->size;
+
+	char *normalized = NULL;
+	size_t normalized_len = 0;
+	size_t normalized_size = 0;
+	struct moved_line *moved = NULL;
+	size_t num_moved = 0;
+	size_t num_invalid = 0;
+
+	char *end = buffer + len;
+	char *line = buffer;
+	while (line < end) {
+		char *eol = memchr(line, delimiter, end - line);
+		if (eol == NULL) {
+			eol = end;
+		}
+		*eol = '\0';
+		if (eol > line
+				&& (unique == NULL
+					|| line_set_add(unique, vec, line, eol - line))) {
+			string_ref_vec_add(vec, line);
+			size_t i = vec->count - 1;
+			vec->buf[i].ascii = simd_is_ascii(line);
+			if (normalize && !vec->buf[i].ascii && !normalize_line(
+						vec,
+						i,
+						&normalized,
+						&normalized_len,
+						&normalized_size,
+						&moved,
+						&num_moved)) {
+				num_invalid++;
+			}
+		}
+		line = eol + 1;
+	}
+
+	if (num_invalid > 0) {
+		log_error("Invalid UTF-8 in input, not normalizing %zu lines.\n", num_invalid);
+	}
+	if (normalized != NULL) {
+		for (size_t i = 0; i < num_moved; i++) {
+			vec->buf[moved[i].index].string = &normalized[moved[i].offset];
+		}
+		keep_buffer(vec, normalized);
+	}
+	free(moved);
+
+	size_t folded_size = 0;
+	for (size_t i = start; i < vec->count; i++) {
+		size_t line_len = strlen(vec->buf[i].string);
+		if (vec->buf[i].ascii) {
+			folded_size += line_len + 1;
+		} else {
+			folded_size += UTF8_FOLD_MAX_SIZE(line_len);
+		}
+	}
+	char *folded_buffer = xmalloc(folded_size + 1);
+	char *folded = folded_buffer;
+	for (size_t i = start; i < vec->count; i++) {
+		vec->buf[i].folded = folded;
+		folded += utf8_fold(vec->buf[i].string, folded) + 1;
+		vec->buf[i].mask = match_mask(vec->buf[i].folded);
+		vec->buf[i].initials = match_initials(vec->buf[i].string);
+	}
+	keep_buffer(vec, folded_buffer);
+
+	if (vec->masks == NULL || vec->size != size) {
+		vec->masks = xrealloc(vec->masks, vec->size * sizeof(*vec->masks));
+	}
+	for (size_t i = start; i < vec->count; i++) {
+		vec->masks[i] = vec->buf[i].mask;
+	}
+}
+
+/*
+ * Create a vector of the lines in the first len bytes of buffer, which must
+ * outlive it (see add_lines()).
+ */
+struct string_ref_vec string_ref_vec_from_buffer(
+		char *buffer,
+		size_t len,
+		char delimiter,
+		bool normalize,
+		struct line_set *unique)
+{
+	struct string_ref_vec vec = string_ref_vec_create();
+	add_lines(&vec, buffer, len, delimiter, normalize, unique);
 	return vec;
 }
+
+/*
+ * Add the lines in the first len bytes of buffer to the end of vec, which
+ * takes ownership of it (see add_lines()). The strings already in vec stay
+ * where they are, so this can be called repeatedly as more input arrives.
+ */
+void string_ref_vec_append_buffer(
+		struct string_ref_vec *restrict vec,
+		char *buffer,
+		size_t len,
+		char delimiter,
+		bool normalize,
+		struct line_set *unique)
+{
+	add_lines(vec, buffer, len, delimiter, normalize, unique);
+	keep_buffer(vec, buffer);
+}
@@ -1,12 +1,15 @@
 #ifndef STRING_VEC_H
 #define STRING_VEC_H
 
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include "arena.h"
 #include "history.h"
 #include "matching.h"
+#include "worker_pool.h"
 
 struct scored_string {
 	char *string;
@@ -18,6 +21,8 @@ struct string_vec {
 	size_t count;
 	size_t size;
 	struct scored_string *buf;
+	/* Storage for the strings themselves. */
+	struct arena strings;
 };
 
 [[nodiscard("memory leaked")]]
@@ -36,17 +41,64 @@ struct scored_string *string_vec_find_sorted(struct string_vec *restrict vec, co
  * Like a string_vec, but only store a reference to the corresponding string
  * rather than copying it. Although compatible with the string_vec struct, we
  * create a new struct to make the compiler complain if we mix them up.
+ *
+ * Each string also has a reference to a case-folded copy of itself (see
+ * utf8_fold()), which is what we actually search through when filtering, and
+ * the match_mask() of that copy, to quickly reject most strings. ascii is set
+ * for pure ASCII strings, which can take faster paths when matching, and
+ * initials are the string's match_initials(), for matching acronyms.
+ *
+ * index is the string's position in the vector it was originally added to
+ * (e.g. the line number of stdin, or the index of a desktop app), and is kept
+ * by copies and filtering, so that results can be traced back to it.
  */
 struct scored_string_ref {
 	char *string;
 	int32_t search_score;
 	int32_t history_score;
+	char *folded;
+	uint64_t mask;
+	uint64_t initials;
+	uint32_t index;
+	bool ascii;
 };
 
 struct string_ref_vec {
 	size_t count;
 	size_t size;
 	struct scored_string_ref *buf;
+	/*
+	 * The number of entries at the start of buf which are in their final
+	 * order, with the rest unordered, but all ranked after them (see
+	 * string_ref_vec_sort_partial()). SIZE_MAX if the whole vector is in
+	 * order, as is the case for anything that isn't a filter result.
+	 */
+	size_t sorted;
+	/*
+	 * Storage owned by this vector, if any: the folded and normalized
+	 * copies of lines added by string_ref_vec_from_buffer() or
+	 * string_ref_vec_append_buffer(), plus the lines themselves for the
+	 * latter.
+	 */
+	char **buffers;
+	size_t num_buffers;
+	/*
+	 * If not NULL, a packed copy of each string's mask, in the same order
+	 * as buf. Most strings are rejected by their mask alone when
+	 * filtering, and reading these rather than whole entries means
+	 * reading a sixth of the memory to do so. Only lists built by
+	 * string_ref_vec_from_buffer() have this, as they're the large ones
+	 * that get searched from scratch, and it belongs to the vector, like
+	 * buffers.
+	 */
+	uint64_t *masks;
+	/*
+	 * If not NULL, buf is shared with other vectors made by
+	 * string_ref_vec_share(), and this counts how many there are. Shared
+	 * entries are never changed in place; anything that would change them
+	 * first gives the vector its own copy.
+	 */
+	atomic_size_t *refs;
 };
 
 /*
@@ -62,9 +114,14 @@ void string_ref_vec_destroy(struct string_ref_vec *restrict vec);
 [[nodiscard("memory leaked")]]
 struct string_ref_vec string_ref_vec_copy(const struct string_ref_vec *restrict vec);
 
+[[nodiscard("memory leaked")]]
+struct string_ref_vec string_ref_vec_share(struct string_ref_vec *restrict vec);
+
 void string_ref_vec_add(struct string_ref_vec *restrict vec, char *restrict str);
 
 void string_ref_vec_history_sort(struct string_ref_vec *restrict vec, struct history *history);
+void string_ref_vec_sort_partial(struct string_ref_vec *restrict vec);
+void string_ref_vec_sort_until(struct string_ref_vec *restrict vec, size_t n);
 
 void string_vec_uniq(struct string_vec *restrict vec);
 
@@ -73,10 +130,55 @@ struct scored_string_ref *string_ref_vec_find_sorted(struct string_ref_vec *rest
 [[nodiscard("memory leaked")]]
 struct string_ref_vec string_ref_vec_filter(
 		const struct string_ref_vec *restrict vec,
-		const char *restrict substr,
-		enum matching_algorithm algorithm);
+		const struct match_query *restrict query);
+
+[[nodiscard("memory leaked")]]
+struct string_ref_vec string_ref_vec_filter_parallel(
+		const struct string_ref_vec *restrict vec,
+		const struct match_query *restrict query,
+		struct worker_pool *pool);
+
+void string_ref_vec_merge(
+		struct string_ref_vec *restrict results,
+		const struct string_ref_vec *restrict more);
+
+/*
+ * A set of the lines added to a string_ref_vec, which can be passed to
+ * string_ref_vec_from_buffer() or string_ref_vec_append_buffer() to skip any
+ * that are already in it. If count_duplicates is set, each line that's
+ * skipped adds one to the history_score of the copy that was kept instead,
+ * once line_set_count_duplicates() is called.
+ *
+ * This is an open-addressing hash table of the lines' positions in the
+ * vector, so they mustn't be moved while the set's in use. A zero-initialised
+ * set is empty.
+ */
+struct line_set {
+	size_t count;
+	size_t size;
+	struct line_set_slot *slots;
+	bool count_duplicates;
+};
+
+void line_set_destroy(struct line_set *set);
+void line_set_count_duplicates(
+		const struct line_set *restrict set,
+		struct string_ref_vec *restrict vec);
 
 [[nodiscard("memory leaked")]]
-struct string_ref_vec string_ref_vec_from_buffer(char *buffer);
+struct string_ref_vec string_ref_vec_from_buffer(
+		char *buffer,
+		size_t len,
+		char delimiter,
+		bool normalize,
+		struct line_set *unique);
+
+void string_ref_vec_append_buffer(
+		struct string_ref_vec *restrict vec,
+		char *buffer,
+		size_t len,
+		char delimiter,
+		bool normalize,
+		struct line_set *unique);
 
 #endif /* STRING_VEC_H */
@@ -8,8 +8,12 @@
 #include "clipboard.h"
 #include "color.h"
 #include "entry.h"
+#include "filter_worker.h"
+#include "line_stream.h"
 #include "matching.h"
 #include "surface.h"
+#include "trigram_index.h"
+#include "worker_pool.h"
 #include "wlr-layer-shell-unstable-v1.h"
 #include "fractional-scale-v1.h"
 
@@ -55,9 +59,14 @@ struct tofi {
 	/* State */
 	bool submit;
 	bool closed;
+	bool input_changed;
 	int32_t output_width;
 	int32_t output_height;
 	struct clipboard clipboard;
+	struct line_stream stream;
+	struct line_set stream_unique;
+	uint32_t stream_next_redraw;
+	bool stream_redraw;
 	struct {
 		struct surface surface;
 		struct wp_viewport *wp_viewport;
@@ -88,6 +97,9 @@ struct tofi {
 		uint32_t next;
 		bool active;
 	} repeat;
+	struct worker_pool worker_pool;
+	struct filter_worker filter_worker;
+	struct trigram_index trigram_index;
 
 	/* Options */
 	uint32_t anchor;
@@ -102,8 +114,20 @@ struct tofi {
 	bool require_match;
 	bool auto_accept_single;
 	bool print_index;
+	bool read0;
+	bool print0;
+	char delimiter;
+	bool dedup;
+	bool dedup_count;
 	bool multiple_instance;
 	bool physical_keybindings;
+	bool stream_input;
+	int32_t drun_weights[DESKTOP_NUM_FIELDS];
+	uint32_t filter_threads;
+	uint32_t filter_threshold;
+	uint32_t index_threshold;
+	uint32_t stream_batch_size;
+	uint32_t stream_redraw_rate;
 	char target_output_name[MAX_OUTPUT_NAME_LEN];
 	char default_terminal[MAX_TERMINAL_NAME_LEN];
 	char history_file[MAX_HISTORY_FILE_NAME_LEN];
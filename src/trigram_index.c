@@ -0,0 +1,371 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include "log.h"
+#include "trigram_index.h"
+#include "xmalloc.h"
+
+#define BUCKET_BITS 18
+#define NUM_BUCKETS (1u << BUCKET_BITS)
+
+/* How many strings to index between checks for cancellation. */
+#define CANCEL_INTERVAL 4096
+
+static uint32_t bucket_of(const char *str)
+{
+	const unsigned char *s = (const unsigned char *)str;
+	uint32_t trigram = (uint32_t)s[0] << 16 | (uint32_t)s[1] << 8 | s[2];
+	return (trigram * 2654435761u) >> (32 - BUCKET_BITS);
+}
+
+static size_t varint_size(uint32_t n)
+{
+	size_t size = 1;
+	while (n >= 0x80) {
+		n >>= 7;
+		size++;
+	}
+	return size;
+}
+
+static uint8_t *varint_write(uint8_t *dst, uint32_t n)
+{
+	while (n >= 0x80) {
+		*dst++ = (n & 0x7F) | 0x80;
+		n >>= 7;
+	}
+	*dst++ = n;
+	return dst;
+}
+
+static const uint8_t *varint_read(const uint8_t *src, uint32_t *n)
+{
+	uint32_t val = 0;
+	unsigned int shift = 0;
+	while (*src & 0x80) {
+		val |= (uint32_t)(*src++ & 0x7F) << shift;
+		shift += 7;
+	}
+	val |= (uint32_t)*src++ << shift;
+	*n = val;
+	return src;
+}
+
+static int cmpinitialsp(const void *a, const void *b)
+{
+	const struct trigram_initials *i1 = a;
+	const struct trigram_initials *i2 = b;
+	return (i1->initials > i2->initials) - (i1->initials < i2->initials);
+}
+
+static int cmpuint32p(const void *a, const void *b)
+{
+	uint32_t n1 = *(const uint32_t *)a;
+	uint32_t n2 = *(const uint32_t *)b;
+	return (n1 > n2) - (n1 < n2);
+}
+
+/*
+ * Build the index in two passes over the strings: the first works out the
+ * size of each posting list, and the second fills them in. last[b] holds one
+ * more than the position of the last string added to bucket b, both to
+ * calculate deltas and so that strings containing a trigram more than once
+ * are only added once.
+ */
+static int build_index(void *data)
+{
+	struct trigram_index *index = data;
+	const struct string_ref_vec *vec = index->vec;
+
+	uint32_t *last = xcalloc(NUM_BUCKETS, sizeof(*last));
+	size_t *offsets = xcalloc(NUM_BUCKETS + 1, sizeof(*offsets));
+	for (size_t i = 0; i < vec->count; i++) {
+		if (i % CANCEL_INTERVAL == 0 && atomic_load(&index->cancel)) {
+			free(offsets);
+			free(last);
+			return 0;
+		}
+		const char *folded = vec->buf[i].folded;
+		size_t len = strlen(folded);
+		for (size_t j = 0; j + 3 <= len; j++) {
+			uint32_t b = bucket_of(&folded[j]);
+			if (last[b] == i + 1) {
+				continue;
+			}
+			uint32_t delta = last[b] == 0 ? i : i - (last[b] - 1);
+			offsets[b + 1] += varint_size(delta);
+			last[b] = i + 1;
+		}
+	}
+	for (size_t b = 0; b < NUM_BUCKETS; b++) {
+		offsets[b + 1] += offsets[b];
+	}
+
+	uint8_t *postings = xmalloc(offsets[NUM_BUCKETS] + 1);
+	uint8_t **cursors = xmalloc(NUM_BUCKETS * sizeof(*cursors));
+	for (size_t b = 0; b < NUM_BUCKETS; b++) {
+		cursors[b] = &postings[offsets[b]];
+	}
+	memset(last, 0, NUM_BUCKETS * sizeof(*last));
+	for (size_t i = 0; i < vec->count; i++) {
+		if (i % CANCEL_INTERVAL == 0 && atomic_load(&index->cancel)) {
+			free(cursors);
+			free(postings);
+			free(offsets);
+			free(last);
+			return 0;
+		}
+		const char *folded = vec->buf[i].folded;
+		size_t len = strlen(folded);
+		for (size_t j = 0; j + 3 <= len; j++) {
+			uint32_t b = bucket_of(&folded[j]);
+			if (last[b] == i + 1) {
+				continue;
+			}
+			uint32_t delta = last[b] == 0 ? i : i - (last[b] - 1);
+			cursors[b] = varint_write(cursors[b], delta);
+			last[b] = i + 1;
+		}
+	}
+	free(cursors);
+	free(last);
+
+	struct trigram_initials *initials = xmalloc(
+			(vec->count + 1) * sizeof(*initials));
+	for (size_t i = 0; i < vec->count; i++) {
+		initials[i] = (struct trigram_initials){
+			.initials = vec->buf[i].initials,
+			.pos = i
+		};
+	}
+	qsort(initials, vec->count, sizeof(*initials), cmpinitialsp);
+
+	index->offsets = offsets;
+	index->postings = postings;
+	index->initials = initials;
+	atomic_store_explicit(&index->ready, true, memory_order_release);
+	return 0;
+}
+
+/*
+ * Start building an index of vec in the background. vec must not change
+ * until the index is destroyed.
+ */
+bool trigram_index_start(
+		struct trigram_index *index,
+		const struct string_ref_vec *vec)
+{
+	*index = (struct trigram_index){
+		.vec = vec
+	};
+	if (thrd_create(&index->thread, build_index, index) != thrd_success) {
+		log_error("Failed to create search index thread.\n");
+		return false;
+	}
+	index->building = true;
+	return true;
+}
+
+void trigram_index_destroy(struct trigram_index *index)
+{
+	if (index->building) {
+		atomic_store(&index->cancel, true);
+		thrd_join(index->thread, NULL);
+	}
+	free(index->offsets);
+	free(index->postings);
+	free(index->initials);
+	*index = (struct trigram_index){ 0 };
+}
+
+/*
+ * Decode the posting list of bucket b into buf, which must be big enough,
+ * returning the number of entries.
+ */
+static size_t decode_bucket(
+		const struct trigram_index *index,
+		uint32_t b,
+		uint32_t *buf)
+{
+	const uint8_t *src = &index->postings[index->offsets[b]];
+	const uint8_t *end = &index->postings[index->offsets[b + 1]];
+	size_t count = 0;
+	uint32_t pos = 0;
+	while (src < end) {
+		uint32_t delta;
+		src = varint_read(src, &delta);
+		pos += delta;
+		buf[count++] = pos;
+	}
+	return count;
+}
+
+/*
+ * Remove any entries of the sorted list buf that aren't in the posting list
+ * of bucket b, returning the new number of entries.
+ */
+static size_t intersect_bucket(
+		const struct trigram_index *index,
+		uint32_t b,
+		uint32_t *buf,
+		size_t count)
+{
+	const uint8_t *src = &index->postings[index->offsets[b]];
+	const uint8_t *end = &index->postings[index->offsets[b + 1]];
+	size_t n = 0;
+	size_t i = 0;
+	uint32_t pos = 0;
+	while (src < end && i < count) {
+		uint32_t delta;
+		src = varint_read(src, &delta);
+		pos += delta;
+		while (i < count && buf[i] < pos) {
+			i++;
+		}
+		if (i < count && buf[i] == pos) {
+			buf[n++] = pos;
+			i++;
+		}
+	}
+	return n;
+}
+
+/*
+ * Merge the positions of the strings whose initials query matches into the
+ * sorted list *positions of count entries, returning the new count.
+ */
+static size_t add_acronyms(
+		const struct trigram_index *index,
+		const struct match_query *restrict query,
+		uint32_t **positions,
+		size_t count)
+{
+	/*
+	 * All of the initials starting with the query's are together, from
+	 * the first which is at least as big as the query's.
+	 */
+	const struct trigram_initials *initials = index->initials;
+	size_t start = 0;
+	size_t end = index->vec->count;
+	while (start < end) {
+		size_t mid = start + (end - start) / 2;
+		if (initials[mid].initials < query->initials) {
+			start = mid + 1;
+		} else {
+			end = mid;
+		}
+	}
+	end = start;
+	while (end < index->vec->count
+			&& (initials[end].initials & query->initials_mask) == query->initials) {
+		end++;
+	}
+	if (end == start) {
+		return count;
+	}
+
+	size_t n = end - start;
+	uint32_t *acronyms = xmalloc(n * sizeof(*acronyms));
+	for (size_t i = 0; i < n; i++) {
+		acronyms[i] = initials[start + i].pos;
+	}
+	qsort(acronyms, n, sizeof(*acronyms), cmpuint32p);
+
+	uint32_t *merged = xmalloc((count + n) * sizeof(*merged));
+	size_t i = 0;
+	size_t j = 0;
+	size_t m = 0;
+	while (i < count || j < n) {
+		if (j == n || (i < count && (*positions)[i] < acronyms[j])) {
+			merged[m++] = (*positions)[i++];
+		} else if (i == count || acronyms[j] < (*positions)[i]) {
+			merged[m++] = acronyms[j++];
+		} else {
+			merged[m++] = (*positions)[i++];
+			j++;
+		}
+	}
+	free(acronyms);
+	free(*positions);
+	*positions = merged;
+	return m;
+}
+
+/*
+ * Find the strings which might match query, in their original order, by
+ * intersecting the posting lists of each trigram in each of its words, and
+ * adding any acronym matches. These still need to be checked properly by
+ * filtering them with query.
+ *
+ * Returns false if the index can't help with this query, because it isn't
+ * ready yet, the query's algorithm doesn't only match substrings, or none of
+ * its words are long enough to contain a trigram.
+ */
+bool trigram_index_lookup(
+		struct trigram_index *index,
+		const struct match_query *restrict query,
+		struct string_ref_vec *candidates)
+{
+	if (!atomic_load_explicit(&index->ready, memory_order_acquire)) {
+		return false;
+	}
+	/*
+	 * A prefix match of a word is still a substring match, but a fuzzy
+	 * match can be spread out anywhere, and a match with typos needn't
+	 * contain any particular trigram.
+	 */
+	if (query->algorithm == MATCHING_ALGORITHM_FUZZY
+			|| query->algorithm == MATCHING_ALGORITHM_TYPO) {
+		return false;
+	}
+
+	/* Start from the shortest posting list, as it's the most selective. */
+	uint32_t shortest = 0;
+	size_t shortest_size = SIZE_MAX;
+	for (size_t w = 0; w < query->count; w++) {
+		const struct match_word *word = &query->words[w];
+		for (size_t j = 0; j + 3 <= word->len; j++) {
+			uint32_t b = bucket_of(&word->str[j]);
+			size_t size = index->offsets[b + 1] - index->offsets[b];
+			if (size < shortest_size) {
+				shortest = b;
+				shortest_size = size;
+			}
+		}
+	}
+	if (shortest_size == SIZE_MAX) {
+		return false;
+	}
+
+	/* Each entry takes at least a byte, so this is always big enough. */
+	uint32_t *positions = xmalloc((shortest_size + 1) * sizeof(*positions));
+	size_t count = decode_bucket(index, shortest, positions);
+	for (size_t w = 0; w < query->count && count > 0; w++) {
+		const struct match_word *word = &query->words[w];
+		for (size_t j = 0; j + 3 <= word->len && count > 0; j++) {
+			uint32_t b = bucket_of(&word->str[j]);
+			if (b != shortest) {
+				count = intersect_bucket(index, b, positions, count);
+			}
+		}
+	}
+	if (query->initials_mask != 0) {
+		count = add_acronyms(index, query, &positions, count);
+	}
+
+	*candidates = string_ref_vec_create();
+	if (count > candidates->size) {
+		candidates->size = count;
+		candidates->buf = xrealloc(candidates->buf, count * sizeof(candidates->buf[0]));
+	}
+	for (size_t i = 0; i < count; i++) {
+		candidates->buf[i] = index->vec->buf[positions[i]];
+	}
+	candidates->count = count;
+	free(positions);
+	return true;
+}
@@ -0,0 +1,59 @@
+#ifndef TRIGRAM_INDEX_H
+#define TRIGRAM_INDEX_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <threads.h>
+#include "matching.h"
+#include "string_vec.h"
+
+/* The initials of the string at position pos. */
+struct trigram_initials {
+	uint64_t initials;
+	uint32_t pos;
+};
+
+/*
+ * An inverted index from the trigrams (runs of three bytes) of each folded
+ * string in a vector to the positions of the strings that contain them, for
+ * quickly narrowing down substring searches of very long lists.
+ *
+ * Trigrams are hashed into a fixed number of buckets, and each bucket's
+ * posting list is stored as a sequence of delta-encoded varints. Hash
+ * collisions just mean a few extra candidates, which are weeded out by
+ * matching them properly afterwards.
+ *
+ * As a short word can also match the initials of a string (see
+ * match_initials()), which needn't contain any of the word's trigrams, every
+ * string's initials are also kept in sorted order, so that the strings a
+ * word's acronym matches can be found with a binary search.
+ *
+ * The index is built on a background thread. Until ready is set, it can't be
+ * used, and searches should just fall back to checking every string. A
+ * zero-initialised index is never ready.
+ */
+struct trigram_index {
+	const struct string_ref_vec *vec;
+	thrd_t thread;
+	bool building;
+	atomic_bool cancel;
+	atomic_bool ready;
+
+	size_t *offsets;
+	uint8_t *postings;
+	struct trigram_initials *initials;
+};
+
+bool trigram_index_start(
+		struct trigram_index *index,
+		const struct string_ref_vec *vec);
+void trigram_index_destroy(struct trigram_index *index);
+
+bool trigram_index_lookup(
+		struct trigram_index *index,
+		const struct match_query *restrict query,
+		struct string_ref_vec *candidates);
+
+#endif /* TRIGRAM_INDEX_H */
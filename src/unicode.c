@@ -2,6 +2,7 @@
 #include <string.h>
 
 #include "unicode.h"
+#include "xmalloc.h"
 
 uint8_t utf32_to_utf8(uint32_t c, char *buf)
 {
@@ -18,6 +19,56 @@ uint32_t utf8_to_utf32_validate(const char *s)
 	return g_utf8_get_char_validated(s, -1);
 }
 
+/*
+ * Return the character at *s, and move *s on to the next one.
+ *
+ * Unlike g_utf8_get_char(), this checks its input: if *s doesn't point to a
+ * valid, complete character, UTF8_INVALID is returned and *s only moves on by
+ * a byte. A sequence is cut short by any byte that can't continue it,
+ * including the terminating nul byte, so this never reads past the end of a
+ * string, however badly it's encoded.
+ */
+uint32_t utf8_decode(const char **s)
+{
+	const unsigned char *p = (const unsigned char *)*s;
+	uint32_t c = p[0];
+	uint32_t min;
+	size_t len;
+	if (c < 0x80) {
+		*s += 1;
+		return c;
+	} else if (c >= 0xC2 && c < 0xE0) {
+		c &= 0x1F;
+		min = 0x80;
+		len = 2;
+	} else if (c >= 0xE0 && c < 0xF0) {
+		c &= 0x0F;
+		min = 0x800;
+		len = 3;
+	} else if (c >= 0xF0 && c < 0xF5) {
+		c &= 0x07;
+		min = 0x10000;
+		len = 4;
+	} else {
+		*s += 1;
+		return UTF8_INVALID;
+	}
+	for (size_t i = 1; i < len; i++) {
+		if ((p[i] & 0xC0) != 0x80) {
+			*s += 1;
+			return UTF8_INVALID;
+		}
+		c = (c << 6) | (p[i] & 0x3F);
+	}
+	/* Reject overlong encodings, surrogates and anything too large. */
+	if (c < min || c > UNICODE_MAX || (c >= 0xD800 && c <= 0xDFFF)) {
+		*s += 1;
+		return UTF8_INVALID;
+	}
+	*s += len;
+	return c;
+}
+
 uint32_t *utf8_string_to_utf32_string(const char *s)
 {
 	return g_utf8_to_ucs4_fast(s, -1, NULL);
@@ -33,31 +84,11 @@ uint32_t utf32_isspace(uint32_t c)
 	return g_unichar_isspace(c);
 }
 
-uint32_t utf32_isupper(uint32_t c)
-{
-	return g_unichar_isupper(c);
-}
-
-uint32_t utf32_islower(uint32_t c)
-{
-	return g_unichar_islower(c);
-}
-
-uint32_t utf32_isalnum(uint32_t c)
-{
-	return g_unichar_isalnum(c);
-}
-
 uint32_t utf32_toupper(uint32_t c)
 {
 	return g_unichar_toupper(c);
 }
 
-uint32_t utf32_tolower(uint32_t c)
-{
-	return g_unichar_tolower(c);
-}
-
 size_t utf32_strlen(const uint32_t *s)
 {
 	size_t len = 0;
@@ -84,10 +115,10 @@ char *utf8_strchr(const char *s, uint32_t c)
 
 char *utf8_strcasechr(const char *s, uint32_t c)
 {
-	c = g_unichar_tolower(c);
+	c = utf32_tolower(c);
 
 	const char *p = s;
-	while (*p != '\0' && g_unichar_tolower(g_utf8_get_char(p)) != c) {
+	while (*p != '\0' && utf32_tolower(g_utf8_get_char(p)) != c) {
 		p = g_utf8_next_char(p);
 	}
 	if (*p == '\0') {
@@ -131,7 +162,88 @@ char *utf8_compose(const char *s)
 	return g_utf8_normalize(s, -1, G_NORMALIZE_DEFAULT_COMPOSE);
 }
 
+/*
+ * Write a lowercase copy of str to buf, which must be at least
+ * UTF8_FOLD_MAX_SIZE(strlen(str)) bytes long, and return the length of the
+ * result in bytes.
+ *
+ * Folding is performed one character at a time (unlike g_utf8_casefold()), so
+ * the result always contains the same number of characters as str, and
+ * offsets in characters are shared between the two strings.
+ *
+ * Each byte of any invalid UTF-8 in str is replaced by UTF8_REPLACEMENT_CHAR,
+ * so the result is always valid.
+ */
+size_t utf8_fold(const char *restrict str, char *restrict buf)
+{
+	const char *s = str;
+	char *p = buf;
+	while (*s != '\0') {
+		unsigned char c = *s;
+		if (c < 0x80) {
+			if (c >= 'A' && c <= 'Z') {
+				c += 'a' - 'A';
+			}
+			*p++ = c;
+			s++;
+			continue;
+		}
+		uint32_t ch = utf8_decode(&s);
+		if (ch == UTF8_INVALID) {
+			ch = UTF8_REPLACEMENT_CHAR;
+		} else {
+			ch = utf32_tolower(ch);
+		}
+		p += g_unichar_to_utf8(ch, p);
+	}
+	*p = '\0';
+	return p - buf;
+}
+
+char *utf8_fold_dup(const char *s)
+{
+	char *buf = xmalloc(UTF8_FOLD_MAX_SIZE(strlen(s)));
+	utf8_fold(s, buf);
+	return buf;
+}
+
 bool utf8_validate(const char *s)
 {
 	return g_utf8_validate(s, -1, NULL);
 }
+
+/*
+ * Return a copy of s with each byte of any invalid UTF-8 replaced by
+ * UTF8_REPLACEMENT_CHAR, as utf8_fold() does, or NULL if s is already valid.
+ */
+char *utf8_make_valid(const char *s)
+{
+	const char *p = s;
+	while (*p != '\0') {
+		const char *c = p;
+		if (utf8_decode(&p) == UTF8_INVALID) {
+			p = c;
+			break;
+		}
+	}
+	if (*p == '\0') {
+		return NULL;
+	}
+
+	/* Each invalid byte can grow to three. */
+	size_t valid_len = p - s;
+	char *buf = xmalloc(valid_len + 3 * strlen(p) + 1);
+	memcpy(buf, s, valid_len);
+	char *dst = buf + valid_len;
+	while (*p != '\0') {
+		const char *c = p;
+		if (utf8_decode(&p) == UTF8_INVALID) {
+			dst += g_unichar_to_utf8(UTF8_REPLACEMENT_CHAR, dst);
+		} else {
+			memcpy(dst, c, p - c);
+			dst += p - c;
+		}
+	}
+	*dst = '\0';
+	return buf;
+}
@@ -5,18 +5,52 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+/*
+ * Folding a character can grow its UTF-8 encoding (e.g. U+023A, 2 bytes, has
+ * the 3 byte lowercase U+2C65), and each invalid byte becomes the 3 byte
+ * U+FFFD, so this is the most space utf8_fold() may need for a string of len
+ * bytes.
+ */
+#define UTF8_FOLD_MAX_SIZE(len) (3 * (len) + 1)
+
+/* What invalid UTF-8 is replaced with, U+FFFD REPLACEMENT CHARACTER. */
+#define UTF8_REPLACEMENT_CHAR 0xFFFD
+
+/* Returned by utf8_decode() for a byte that doesn't start a valid character. */
+#define UTF8_INVALID UINT32_MAX
+
+/*
+ * Case and character class lookup tables, generated at build time from glib's
+ * Unicode data by main_unicode_tables.c.
+ *
+ * Each table is split into blocks of UNICODE_BLOCK_SIZE characters, and
+ * identical blocks are only stored once. The high bits of a character index
+ * its block, and the low bits its entry within the block. The lowercase table
+ * stores the difference between each character and its lowercase version.
+ */
+#define UNICODE_MAX 0x10FFFF
+#define UNICODE_BLOCK_SHIFT 8
+#define UNICODE_BLOCK_SIZE (1 << UNICODE_BLOCK_SHIFT)
+#define UNICODE_NUM_BLOCKS ((UNICODE_MAX + 1) >> UNICODE_BLOCK_SHIFT)
+
+#define UNICODE_CLASS_UPPER (1 << 0)
+#define UNICODE_CLASS_LOWER (1 << 1)
+#define UNICODE_CLASS_ALNUM (1 << 2)
+
+extern const uint8_t unicode_class_index[UNICODE_NUM_BLOCKS];
+extern const uint8_t unicode_class_blocks[][UNICODE_BLOCK_SIZE];
+extern const uint8_t unicode_lower_index[UNICODE_NUM_BLOCKS];
+extern const int32_t unicode_lower_blocks[][UNICODE_BLOCK_SIZE];
+
 uint8_t utf32_to_utf8(uint32_t c, char *buf);
 uint32_t utf8_to_utf32(const char *s);
 uint32_t utf8_to_utf32_validate(const char *s);
+uint32_t utf8_decode(const char **s);
 uint32_t *utf8_string_to_utf32_string(const char *s);
 
 uint32_t utf32_isprint(uint32_t c);
 uint32_t utf32_isspace(uint32_t c);
-uint32_t utf32_isupper(uint32_t c);
-uint32_t utf32_islower(uint32_t c);
-uint32_t utf32_isalnum(uint32_t c);
 uint32_t utf32_toupper(uint32_t c);
-uint32_t utf32_tolower(uint32_t c);
 size_t utf32_strlen(const uint32_t *s);
 
 char *utf8_next_char(const char *s);
@@ -27,6 +61,42 @@ size_t utf8_strlen(const char *s);
 char *utf8_strcasestr(const char * restrict haystack, const char * restrict needle);
 char *utf8_normalize(const char *s);
 char *utf8_compose(const char *s);
+size_t utf8_fold(const char *restrict s, char *restrict buf);
+char *utf8_fold_dup(const char *s);
 bool utf8_validate(const char *s);
+char *utf8_make_valid(const char *s);
+
+static inline uint8_t utf32_class(uint32_t c)
+{
+	if (c > UNICODE_MAX) {
+		return 0;
+	}
+	uint8_t block = unicode_class_index[c >> UNICODE_BLOCK_SHIFT];
+	return unicode_class_blocks[block][c & (UNICODE_BLOCK_SIZE - 1)];
+}
+
+static inline uint32_t utf32_isupper(uint32_t c)
+{
+	return utf32_class(c) & UNICODE_CLASS_UPPER;
+}
+
+static inline uint32_t utf32_islower(uint32_t c)
+{
+	return utf32_class(c) & UNICODE_CLASS_LOWER;
+}
+
+static inline uint32_t utf32_isalnum(uint32_t c)
+{
+	return utf32_class(c) & UNICODE_CLASS_ALNUM;
+}
+
+static inline uint32_t utf32_tolower(uint32_t c)
+{
+	if (c > UNICODE_MAX) {
+		return c;
+	}
+	uint8_t block = unicode_lower_index[c >> UNICODE_BLOCK_SHIFT];
+	return c + unicode_lower_blocks[block][c & (UNICODE_BLOCK_SIZE - 1)];
+}
 
 #endif /* UNICODE_H */
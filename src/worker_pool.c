@@ -0,0 +1,143 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <threads.h>
+#include "log.h"
+#include "worker_pool.h"
+#include "xmalloc.h"
+
+/*
+ * Take the next job from the current batch, and run it.
+ * Must be called with the lock held, and returns with it held.
+ */
+static void run_next_job(struct worker_pool *pool)
+{
+	size_t job = pool->next_job++;
+	mtx_unlock(&pool->lock);
+	pool->func(pool->arg, job);
+	mtx_lock(&pool->lock);
+	pool->jobs_done++;
+	if (pool->jobs_done == pool->num_jobs) {
+		cnd_signal(&pool->work_done);
+	}
+}
+
+static int worker_main(void *data)
+{
+	struct worker_pool *pool = data;
+	mtx_lock(&pool->lock);
+	while (true) {
+		while (!pool->quit && pool->next_job >= pool->num_jobs) {
+			cnd_wait(&pool->work_ready, &pool->lock);
+		}
+		if (pool->quit) {
+			break;
+		}
+		run_next_job(pool);
+	}
+	mtx_unlock(&pool->lock);
+	return 0;
+}
+
+/*
+ * Start count threads. The thread calling worker_pool_run() also does its
+ * share of the work, so for N-way parallelism, count should be N - 1.
+ *
+ * If anything goes wrong, everything is undone, and the pool is left with no
+ * threads and failed set, so that callers know not to try again.
+ */
+bool worker_pool_init(struct worker_pool *pool, size_t count)
+{
+	*pool = (struct worker_pool){ 0 };
+	if (mtx_init(&pool->lock, mtx_plain) != thrd_success) {
+		log_error("Failed to create worker pool mutex.\n");
+		goto cleanup_none;
+	}
+	if (cnd_init(&pool->work_ready) != thrd_success) {
+		log_error("Failed to create worker pool condition variable.\n");
+		goto cleanup_lock;
+	}
+	if (cnd_init(&pool->work_done) != thrd_success) {
+		log_error("Failed to create worker pool condition variable.\n");
+		goto cleanup_work_ready;
+	}
+	pool->threads = xcalloc(count, sizeof(*pool->threads));
+	for (size_t i = 0; i < count; i++) {
+		if (thrd_create(&pool->threads[i], worker_main, pool) != thrd_success) {
+			log_error("Failed to create worker thread.\n");
+			goto cleanup_threads;
+		}
+		pool->count++;
+	}
+	log_debug("Started %zu worker threads.\n", pool->count);
+	return true;
+
+cleanup_threads:
+	mtx_lock(&pool->lock);
+	pool->quit = true;
+	cnd_broadcast(&pool->work_ready);
+	mtx_unlock(&pool->lock);
+	for (size_t i = 0; i < pool->count; i++) {
+		thrd_join(pool->threads[i], NULL);
+	}
+	free(pool->threads);
+	cnd_destroy(&pool->work_done);
+cleanup_work_ready:
+	cnd_destroy(&pool->work_ready);
+cleanup_lock:
+	mtx_destroy(&pool->lock);
+cleanup_none:
+	*pool = (struct worker_pool){ .failed = true };
+	return false;
+}
+
+void worker_pool_destroy(struct worker_pool *pool)
+{
+	if (pool->threads == NULL) {
+		return;
+	}
+	mtx_lock(&pool->lock);
+	pool->quit = true;
+	cnd_broadcast(&pool->work_ready);
+	mtx_unlock(&pool->lock);
+	for (size_t i = 0; i < pool->count; i++) {
+		thrd_join(pool->threads[i], NULL);
+	}
+	free(pool->threads);
+	cnd_destroy(&pool->work_done);
+	cnd_destroy(&pool->work_ready);
+	mtx_destroy(&pool->lock);
+	*pool = (struct worker_pool){ 0 };
+}
+
+/*
+ * Call func(arg, job) for each job in [0, num_jobs), spread across the pool's
+ * threads and the calling thread, and wait for them all to finish.
+ */
+void worker_pool_run(
+		struct worker_pool *pool,
+		void (*func)(void *arg, size_t job),
+		void *arg,
+		size_t num_jobs)
+{
+	if (pool->count == 0) {
+		for (size_t i = 0; i < num_jobs; i++) {
+			func(arg, i);
+		}
+		return;
+	}
+	mtx_lock(&pool->lock);
+	pool->func = func;
+	pool->arg = arg;
+	pool->num_jobs = num_jobs;
+	pool->next_job = 0;
+	pool->jobs_done = 0;
+	cnd_broadcast(&pool->work_ready);
+	while (pool->next_job < pool->num_jobs) {
+		run_next_job(pool);
+	}
+	while (pool->jobs_done < pool->num_jobs) {
+		cnd_wait(&pool->work_done, &pool->lock);
+	}
+	mtx_unlock(&pool->lock);
+}
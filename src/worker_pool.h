@@ -0,0 +1,40 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <threads.h>
+
+/*
+ * A small pool of persistent threads, used to split up loops over large
+ * amounts of data. A zero-initialised pool has no threads, and
+ * worker_pool_run() will just run everything on the calling thread.
+ */
+struct worker_pool {
+	size_t count;
+	thrd_t *threads;
+	mtx_t lock;
+	cnd_t work_ready;
+	cnd_t work_done;
+
+	/* The current batch of jobs. */
+	void (*func)(void *arg, size_t job);
+	void *arg;
+	size_t num_jobs;
+	size_t next_job;
+	size_t jobs_done;
+	bool quit;
+
+	/* Set if worker_pool_init() failed, in which case it isn't retried. */
+	bool failed;
+};
+
+bool worker_pool_init(struct worker_pool *pool, size_t count);
+void worker_pool_destroy(struct worker_pool *pool);
+void worker_pool_run(
+		struct worker_pool *pool,
+		void (*func)(void *arg, size_t job),
+		void *arg,
+		size_t num_jobs);
+
+#endif /* WORKER_POOL_H */
@@ -29,6 +29,18 @@ void *xcalloc(size_t nmemb, size_t size)
 	}
 }
 
+void *xaligned_alloc(size_t alignment, size_t size)
+{
+	void *ptr = aligned_alloc(alignment, size);
+
+	if (ptr != NULL) {
+		return ptr;
+	} else {
+		log_error("Out of memory, exiting.\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
 void *xrealloc(void *ptr, size_t size)
 {
 	ptr = realloc(ptr, size);
@@ -11,6 +11,10 @@ void *xmalloc(size_t size);
 [[gnu::malloc]]
 void *xcalloc(size_t nmemb, size_t size);
 
+[[nodiscard("memory leaked")]]
+[[gnu::malloc]]
+void *xaligned_alloc(size_t alignment, size_t size);
+
 [[nodiscard("memory leaked")]]
 void *xrealloc(void *ptr, size_t size);
 
@@ -49,6 +49,7 @@ int main(int argc, char *argv[])
 	is_valid("matching-algorithm", "normal", "Normal matching");
 	is_valid("matching-algorithm", "fuzzy", "Fuzzy matching");
 	is_valid("matching-algorithm", "prefix", "Prefix matching");
+	is_valid("matching-algorithm", "typo", "Typo-tolerant matching");
 	isnt_valid("matching-algorithm", "regex", "Regex matching");
 
 	/* Bools */
@@ -64,6 +65,12 @@ int main(int argc, char *argv[])
 	is_valid("hidden-character", "漢", "Single CJK character");
 	isnt_valid("hidden-character", "ae", "Multiple characters");
 
+	/* Delimiters */
+	is_valid("delimiter", ",", "Single ASCII delimiter");
+	isnt_valid("delimiter", "é", "Non-ASCII delimiter");
+	isnt_valid("delimiter", ", ", "Multiple character delimiter");
+	isnt_valid("delimiter", "", "Empty delimiter");
+
 	/* Colours */
 	is_valid("text-color", "46B", "Three character color without hash");
 	is_valid("text-color", "#46B", "Three character color with hash");
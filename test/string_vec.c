@@ -0,0 +1,259 @@
+#include <locale.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "string_vec.h"
+#include "tap.h"
+
+/* U+FFFD REPLACEMENT CHARACTER. */
+#define REPLACEMENT "\xEF\xBF\xBD"
+
+/* Higher scores first, then lower indices, as described in string_vec.c. */
+int cmp_rank(const void *a, const void *b)
+{
+	const struct scored_string_ref *str1 = a;
+	const struct scored_string_ref *str2 = b;
+	int64_t score1 = (int64_t)str1->search_score + str1->history_score;
+	int64_t score2 = (int64_t)str2->search_score + str2->history_score;
+	score1 = score1 > INT32_MAX ? INT32_MAX : score1 < INT32_MIN ? INT32_MIN : score1;
+	score2 = score2 > INT32_MAX ? INT32_MAX : score2 < INT32_MIN ? INT32_MIN : score2;
+	if (score1 != score2) {
+		return score1 < score2 ? 1 : -1;
+	}
+	return (str1->index > str2->index) - (str1->index < str2->index);
+}
+
+/*
+ * A fake list of filter results, in a random order, with few enough distinct
+ * scores that there are plenty of ties.
+ */
+struct string_ref_vec random_results(size_t count, int32_t num_scores)
+{
+	struct string_ref_vec vec = string_ref_vec_create();
+	for (size_t i = 0; i < count; i++) {
+		string_ref_vec_add(&vec, "");
+		vec.buf[i].index = i;
+		vec.buf[i].search_score = rand() % num_scores - num_scores / 2;
+		vec.buf[i].history_score = rand() % 4;
+	}
+	/* Saturated scores have to tie too. */
+	if (count > 2) {
+		vec.buf[0].search_score = INT32_MAX;
+		vec.buf[0].history_score = 1;
+		vec.buf[1].search_score = INT32_MAX;
+		vec.buf[2].search_score = INT32_MIN;
+		vec.buf[2].history_score = -1;
+	}
+	for (size_t i = count; i > 1; i--) {
+		size_t j = rand() % i;
+		struct scored_string_ref tmp = vec.buf[i - 1];
+		vec.buf[i - 1] = vec.buf[j];
+		vec.buf[j] = tmp;
+	}
+	return vec;
+}
+
+/*
+ * Check that the first n entries of vec are the first n of sorted, and that
+ * the rest are still there in some order.
+ */
+bool matches_prefix(const struct string_ref_vec *vec, const struct string_ref_vec *sorted, size_t n)
+{
+	if (vec->count != sorted->count) {
+		return false;
+	}
+	for (size_t i = 0; i < n && i < vec->count; i++) {
+		if (vec->buf[i].index != sorted->buf[i].index) {
+			return false;
+		}
+	}
+	bool *seen = calloc(vec->count, sizeof(*seen));
+	bool ok = true;
+	for (size_t i = 0; i < vec->count; i++) {
+		uint32_t index = vec->buf[i].index;
+		if (index >= vec->count || seen[index]) {
+			ok = false;
+			break;
+		}
+		seen[index] = true;
+	}
+	free(seen);
+	return ok;
+}
+
+void is_sorted_until(size_t count, int32_t num_scores, const char *message)
+{
+	struct string_ref_vec vec = random_results(count, num_scores);
+	struct string_ref_vec sorted = string_ref_vec_copy(&vec);
+	qsort(sorted.buf, sorted.count, sizeof(sorted.buf[0]), cmp_rank);
+
+	/* Sorting from scratch up to each length. */
+	bool ok = true;
+	for (size_t n = 0; n <= count && ok; n++) {
+		struct string_ref_vec copy = string_ref_vec_copy(&vec);
+		string_ref_vec_sort_partial(&copy);
+		string_ref_vec_sort_until(&copy, n);
+		ok = matches_prefix(&copy, &sorted, n);
+		string_ref_vec_destroy(&copy);
+	}
+
+	/* Sorting a little more at a time, as the renderers do. */
+	string_ref_vec_sort_partial(&vec);
+	for (size_t n = 0; n <= count && ok; n++) {
+		string_ref_vec_sort_until(&vec, n);
+		ok = matches_prefix(&vec, &sorted, n);
+	}
+	string_ref_vec_sort_until(&vec, SIZE_MAX);
+	ok = ok && vec.sorted == SIZE_MAX && matches_prefix(&vec, &sorted, count);
+
+	tap_is(ok, true, message);
+	string_ref_vec_destroy(&sorted);
+	string_ref_vec_destroy(&vec);
+}
+
+/*
+ * Check that reading the len bytes of input gives the lines in expected, a
+ * NULL-terminated list.
+ */
+void is_lines(
+		const char *input,
+		size_t len,
+		char delimiter,
+		bool normalize,
+		const char *const *expected,
+		const char *message)
+{
+	char *buf = malloc(len + 1);
+	memcpy(buf, input, len);
+	buf[len] = '\0';
+	struct string_ref_vec vec = string_ref_vec_from_buffer(buf, len, delimiter, normalize, NULL);
+	bool ok = true;
+	for (size_t i = 0; ok && i <= vec.count; i++) {
+		if (i == vec.count || expected[i] == NULL) {
+			ok = i == vec.count && expected[i] == NULL;
+		} else {
+			ok = strcmp(vec.buf[i].string, expected[i]) == 0;
+		}
+	}
+	tap_is(ok, true, message);
+	string_ref_vec_destroy(&vec);
+	free(buf);
+}
+
+/*
+ * Check that reading each of inputs in turn, skipping duplicate lines and
+ * counting them if count is set, and then sorting the lines as tofi does, gives
+ * the lines in expected. Both lists are NULL-terminated.
+ */
+void is_dedup(
+		const char *const *inputs,
+		bool count,
+		const char *const *expected,
+		const char *message)
+{
+	struct line_set unique = { .count_duplicates = count };
+	char *first = strdup(inputs[0]);
+	struct string_ref_vec vec = string_ref_vec_from_buffer(first, strlen(first), '\n', true, &unique);
+	for (size_t i = 1; inputs[i] != NULL; i++) {
+		char *buf = strdup(inputs[i]);
+		string_ref_vec_append_buffer(&vec, buf, strlen(buf), '\n', true, &unique);
+	}
+	line_set_count_duplicates(&unique, &vec);
+	line_set_destroy(&unique);
+	if (count) {
+		struct history history = { 0 };
+		string_ref_vec_history_sort(&vec, &history);
+	}
+
+	bool ok = true;
+	for (size_t i = 0; ok && i <= vec.count; i++) {
+		if (i == vec.count || expected[i] == NULL) {
+			ok = i == vec.count && expected[i] == NULL;
+		} else {
+			ok = strcmp(vec.buf[i].string, expected[i]) == 0;
+		}
+	}
+	tap_is(ok, true, message);
+	string_ref_vec_destroy(&vec);
+	free(first);
+}
+
+int main(int argc, char *argv[])
+{
+	setlocale(LC_ALL, "");
+	srand(1);
+
+	tap_version(14);
+
+	/* Partial sorting of results. */
+	is_sorted_until(0, 1, "Sort nothing");
+	is_sorted_until(1, 1, "Sort one result");
+	is_sorted_until(100, 1, "Sort equal scores");
+	is_sorted_until(100, 10, "Sort fewer results than a chunk");
+	is_sorted_until(1000, 10, "Sort many duplicate scores");
+	is_sorted_until(1000, 100000, "Sort mostly distinct scores");
+
+	/* Splitting input into lines. */
+	const char *const lines_abc[] = { "a", "b", "c", NULL };
+	is_lines("a\nb\nc\n", 6, '\n', true, lines_abc, "Split lines");
+	is_lines("a\nb\nc", 5, '\n', true, lines_abc, "Split lines without a final newline");
+	is_lines("\na\n\nb\n\n\nc\n", 10, '\n', true, lines_abc, "Skip empty lines");
+	is_lines("a,b,,c,", 7, ',', true, lines_abc, "Split on a custom delimiter");
+	is_lines("a\0b\0\0c", 7, '\0', true, lines_abc, "Split on nul bytes");
+	const char *const lines_multiline[] = { "a\nb", "c,d", NULL };
+	is_lines("a\nb\0c,d\0", 9, '\0', true, lines_multiline, "Keep newlines when splitting on nul bytes");
+	const char *const lines_none[] = { NULL };
+	is_lines("\0\0", 2, '\0', true, lines_none, "Only delimiters");
+
+	/* Removing and counting duplicates. */
+	const char *const inputs_dup[] = { "b\na\nb\nc\na\na\n", NULL };
+	const char *const lines_dup[] = { "b", "a", "c", NULL };
+	const char *const lines_dup_count[] = { "a", "b", "c", NULL };
+	is_dedup(inputs_dup, false, lines_dup, "Remove duplicates");
+	is_dedup(inputs_dup, true, lines_dup_count, "Count duplicates");
+	const char *const inputs_dup_split[] = { "b\na\n", "b\nc\na", "\na\n", NULL };
+	is_dedup(inputs_dup_split, false, lines_dup, "Remove duplicates read separately");
+	is_dedup(inputs_dup_split, true, lines_dup_count, "Count duplicates read separately");
+
+	/* Lots of ties, which must all stay in the order they were read. */
+	char *input_ties = malloc(100 * 16);
+	size_t ties_len = 0;
+	const char *lines_ties[102];
+	char names[100][8];
+	for (size_t copy = 0; copy < 2; copy++) {
+		for (size_t i = 0; i < 100; i++) {
+			sprintf(names[i], "l%zu", (i * 37) % 100);
+			ties_len += sprintf(&input_ties[ties_len], "%s\n", names[i]);
+			lines_ties[i + 1] = names[i];
+		}
+		ties_len += sprintf(&input_ties[ties_len], "top\ntop\n");
+	}
+	lines_ties[0] = "top";
+	lines_ties[101] = NULL;
+	const char *const inputs_ties[] = { input_ties, NULL };
+	is_dedup(inputs_ties, true, lines_ties, "Keep the order of equal counts");
+	free(input_ties);
+
+	/*
+	 * Lines with invalid UTF-8 are kept byte-for-byte, whether or not lines
+	 * are normalized, as they may be file names. Only their folded copies
+	 * have it replaced.
+	 */
+	const char input_invalid[] = "a\x80" "b\nok\n\xE2\x82\ne\xCC\x81\xFF\n";
+	const char *const lines_invalid[] = { "a\x80" "b", "ok", "\xE2\x82", "e\xCC\x81\xFF", NULL };
+	is_lines(input_invalid, strlen(input_invalid), '\n', true, lines_invalid, "Keep invalid UTF-8");
+	is_lines(input_invalid, strlen(input_invalid), '\n', false, lines_invalid, "Keep invalid UTF-8 without normalizing");
+	char input_fold[] = "A\xFF" "b";
+	struct string_ref_vec vec_fold = string_ref_vec_from_buffer(input_fold, strlen(input_fold), '\n', true, NULL);
+	bool folded = vec_fold.count == 1
+		&& strcmp(vec_fold.buf[0].string, "A\xFF" "b") == 0
+		&& strcmp(vec_fold.buf[0].folded, "a" REPLACEMENT "b") == 0;
+	tap_is(folded, true, "Replace invalid UTF-8 only when folding");
+	string_ref_vec_destroy(&vec_fold);
+
+	tap_plan();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,138 @@
+#include <locale.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include "matching.h"
+#include "string_vec.h"
+#include "tap.h"
+#include "trigram_index.h"
+#include "xmalloc.h"
+
+static const char *words[] = {
+	"firefox", "fire", "fox", "visual", "studio", "code", "VisualStudioCode",
+	"gnu", "image", "manipulation", "program", "terminal", "term", "dom",
+	"ДОМ", "Добрый", "мир", "Привет", "naïve", "café", "ab", "abc", "a"
+};
+
+/*
+ * Lines made of a few random words each, plus a rare word every so often,
+ * so that some posting lists have large gaps between their entries.
+ */
+char *make_lines(size_t count, size_t *len)
+{
+	size_t num_words = sizeof(words) / sizeof(words[0]);
+	char *buf = xmalloc(count * 64 + 1);
+	size_t n = 0;
+	for (size_t i = 0; i < count; i++) {
+		size_t line_words = 1 + rand() % 3;
+		for (size_t j = 0; j < line_words; j++) {
+			n += sprintf(&buf[n], "%s%s", j == 0 ? "" : " ", words[rand() % num_words]);
+		}
+		if (i % 20011 == 7) {
+			n += sprintf(&buf[n], " zqxj");
+		}
+		buf[n++] = '\n';
+	}
+	buf[n] = '\0';
+	*len = n;
+	return buf;
+}
+
+bool same_results(struct string_ref_vec *a, struct string_ref_vec *b)
+{
+	string_ref_vec_sort_until(a, SIZE_MAX);
+	string_ref_vec_sort_until(b, SIZE_MAX);
+	if (a->count != b->count) {
+		return false;
+	}
+	for (size_t i = 0; i < a->count; i++) {
+		if (a->buf[i].index != b->buf[i].index) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Check that looking query up in the index and then checking the candidates
+ * finds the same strings as checking every string in vec, and that the index
+ * is only used if indexed is set.
+ */
+void is_lookup(
+		struct trigram_index *index,
+		const struct string_ref_vec *vec,
+		enum matching_algorithm algorithm,
+		const char *text,
+		bool indexed,
+		const char *message)
+{
+	struct match_query query = match_query_create(algorithm, text);
+	struct string_ref_vec expected = string_ref_vec_filter(vec, &query);
+	struct string_ref_vec candidates;
+	bool used = trigram_index_lookup(index, &query, &candidates);
+	bool ok = used == indexed;
+	if (ok && used) {
+		struct string_ref_vec results = string_ref_vec_filter(&candidates, &query);
+		ok = same_results(&results, &expected);
+		string_ref_vec_destroy(&results);
+	}
+	if (used) {
+		string_ref_vec_destroy(&candidates);
+	}
+	tap_is(ok, true, message);
+	string_ref_vec_destroy(&expected);
+	match_query_destroy(&query);
+}
+
+int main(int argc, char *argv[])
+{
+	setlocale(LC_ALL, "");
+	srand(1);
+
+	tap_version(14);
+
+	size_t len;
+	char *buf = make_lines(100000, &len);
+	struct string_ref_vec vec = string_ref_vec_from_buffer(buf, len, '\n', true, NULL);
+	struct trigram_index index;
+	trigram_index_start(&index, &vec);
+	while (!atomic_load(&index.ready)) {
+		thrd_yield();
+	}
+
+	const enum matching_algorithm n = MATCHING_ALGORITHM_NORMAL;
+	const enum matching_algorithm p = MATCHING_ALGORITHM_PREFIX;
+
+	is_lookup(&index, &vec, n, "fire", true, "Single word");
+	is_lookup(&index, &vec, n, "FIREFOX", true, "Different case");
+	is_lookup(&index, &vec, n, "fox fire", true, "Several words");
+	is_lookup(&index, &vec, n, "studiocode", true, "Word spanning camel case");
+	is_lookup(&index, &vec, n, "zqxj", true, "Rare word with large gaps");
+	is_lookup(&index, &vec, n, "zqxj fire", true, "Rare and common words");
+	is_lookup(&index, &vec, n, "nothing", true, "No matches");
+	is_lookup(&index, &vec, n, "дом", true, "Cyrillic");
+	is_lookup(&index, &vec, n, "ДОБР", true, "Cyrillic, different case");
+	is_lookup(&index, &vec, n, "naïve", true, "Latin with diacritic");
+	is_lookup(&index, &vec, n, "мир", true, "Cyrillic word of three letters");
+	is_lookup(&index, &vec, n, "é", true, "Single decomposed character");
+	is_lookup(&index, &vec, n, "ж", false, "Non-ASCII word too short to index");
+	is_lookup(&index, &vec, n, "ab gnu", true, "Short and long words");
+	is_lookup(&index, &vec, n, "vsc", true, "Acronym");
+	is_lookup(&index, &vec, n, "vs code", true, "Acronym and word");
+	is_lookup(&index, &vec, n, "ab", false, "Query too short to index");
+	is_lookup(&index, &vec, n, "a b", false, "Words too short to index");
+	is_lookup(&index, &vec, p, "term", true, "Prefix matching");
+	is_lookup(&index, &vec, p, "ми", true, "Prefix matching, two Cyrillic letters");
+	is_lookup(&index, &vec, MATCHING_ALGORITHM_FUZZY, "fire", false, "Fuzzy matching isn't indexed");
+
+	trigram_index_destroy(&index);
+	string_ref_vec_destroy(&vec);
+	free(buf);
+
+	tap_plan();
+
+	return EXIT_SUCCESS;
+}
@@ -1,20 +1,25 @@
 #include <assert.h>
 #include <locale.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "matching.h"
 #include "tap.h"
+#include "unicode.h"
+
+/* U+FFFD REPLACEMENT CHARACTER. */
+#define REPLACEMENT "\xEF\xBF\xBD"
 
 void is_single_match(enum matching_algorithm algorithm, const char *pattern, const char *str, const char *message)
 {
-	int32_t res = match_words(algorithm, pattern, str);
+	int32_t res = match_words(algorithm, pattern, str, NULL);
 	tap_isnt(res, INT32_MIN, message);
 }
 
 void isnt_single_match(enum matching_algorithm algorithm, const char *pattern, const char *str, const char *message)
 {
-	int32_t res = match_words(algorithm, pattern, str);
+	int32_t res = match_words(algorithm, pattern, str, NULL);
 	tap_is(res, INT32_MIN, message);
 }
 
@@ -32,6 +37,31 @@ void isnt_match(const char *pattern, const char *str, const char *message)
 	isnt_single_match(MATCHING_ALGORITHM_FUZZY, pattern, str, message);
 }
 
+void is_score(enum matching_algorithm algorithm, const char *pattern, const char *str, int32_t score, const char *message)
+{
+	int32_t res = match_words(algorithm, pattern, str, NULL);
+	tap_is(res, score, message);
+}
+
+void is_span(enum matching_algorithm algorithm, const char *pattern, const char *str, size_t index, uint32_t start, uint32_t end, const char *message)
+{
+	struct match_spans spans;
+	match_words(algorithm, pattern, str, &spans);
+	bool ok = index < spans.count
+		&& spans.span[index].start == start
+		&& spans.span[index].end == end;
+	tap_is(ok, true, message);
+}
+
+void is_fold(const char *str, const char *folded, const char *message)
+{
+	/* Exactly as much as is allowed, so that ASan catches any overflow. */
+	char *buf = malloc(UTF8_FOLD_MAX_SIZE(strlen(str)));
+	size_t len = utf8_fold(str, buf);
+	tap_is(len == strlen(folded) && strcmp(buf, folded) == 0, true, message);
+	free(buf);
+}
+
 int main(int argc, char *argv[])
 {
 	setlocale(LC_ALL, "");
@@ -50,6 +80,71 @@ int main(int argc, char *argv[])
 	tap_todo("Needs composed character comparison");
 	isnt_single_match(MATCHING_ALGORITHM_FUZZY, "ạ", "aọ", "Decomposed diacritics, character mismatch");
 
+	/* Match spans. */
+	is_span(MATCHING_ALGORITHM_NORMAL, "bc", "abcd", 0, 1, 3, "Substring span");
+	is_span(MATCHING_ALGORITHM_NORMAL, "д", "aДb", 0, 1, 3, "Substring span, multibyte character");
+	is_span(MATCHING_ALGORITHM_PREFIX, "AB", "abc", 0, 0, 2, "Prefix span");
+	is_span(MATCHING_ALGORITHM_FUZZY, "ac", "abc", 1, 2, 3, "Separate fuzzy spans");
+	is_span(MATCHING_ALGORITHM_FUZZY, "abc", "xabc", 0, 1, 4, "Adjacent fuzzy spans are merged");
+	is_span(MATCHING_ALGORITHM_NORMAL, "cd ab", "abcd", 0, 0, 4, "Spans of different words are merged");
+
+	/*
+	 * Fuzzy scores, as given by the old exhaustive search, which the
+	 * dynamic programming matcher must reproduce.
+	 */
+	is_score(MATCHING_ALGORITHM_FUZZY, "abc", "abc", 45, "Fuzzy score, exact");
+	is_score(MATCHING_ALGORITHM_FUZZY, "abc", "xxabcxx", 16, "Fuzzy score, leading letters");
+	is_score(MATCHING_ALGORITHM_FUZZY, "abc", "aXbXc", 13, "Fuzzy score, gaps");
+	is_score(MATCHING_ALGORITHM_FUZZY, "ace", "abcde", 13, "Fuzzy score, gaps between lowercase");
+	is_score(MATCHING_ALGORITHM_FUZZY, "ab", "aab", 14, "Fuzzy score, repeated first character");
+	is_score(MATCHING_ALGORITHM_FUZZY, "aa", "banana", -9, "Fuzzy score, repeated pattern character");
+	is_score(MATCHING_ALGORITHM_FUZZY, "ana", "banana", 22, "Fuzzy score, repeated substring");
+	is_score(MATCHING_ALGORITHM_FUZZY, "aaa", "aaaa", 44, "Fuzzy score, run of one character");
+	is_score(MATCHING_ALGORITHM_FUZZY, "abc", "a_b_c", 73, "Fuzzy score, separators");
+	is_score(MATCHING_ALGORITHM_FUZZY, "od", "foo/bar/odd", 21, "Fuzzy score, path separators");
+	is_score(MATCHING_ALGORITHM_FUZZY, "vsc", "Visual Studio Code", 60, "Fuzzy score, word starts");
+	is_score(MATCHING_ALGORITHM_FUZZY, "vsc", "VisualStudioCode", 62, "Fuzzy score, camel case");
+	is_score(MATCHING_ALGORITHM_FUZZY, "ffx", "Firefox", 11, "Fuzzy score, skipping a better first match");
+
+	/* Typos. */
+	is_single_match(MATCHING_ALGORITHM_TYPO, "fierfox", "Firefox", "Swapped letters");
+	is_single_match(MATCHING_ALGORITHM_TYPO, "firfox", "Firefox", "Missing letter");
+	is_single_match(MATCHING_ALGORITHM_TYPO, "пирвет", "Привет мир", "Swapped Cyrillic letters");
+	isnt_single_match(MATCHING_ALGORITHM_TYPO, "fierfx", "Firefox", "Too many typos");
+	isnt_single_match(MATCHING_ALGORITHM_TYPO, "fox", "fix", "Short words must match exactly");
+	is_span(MATCHING_ALGORITHM_TYPO, "fierfox", "a firefox", 0, 2, 9, "Typo span");
+
+	/* Acronyms. */
+	is_single_match(MATCHING_ALGORITHM_NORMAL, "vsc", "Visual Studio Code", "Acronym");
+	is_single_match(MATCHING_ALGORITHM_PREFIX, "vs", "Visual Studio Code", "Partial acronym");
+	is_single_match(MATCHING_ALGORITHM_TYPO, "gimp", "GNU Image Manipulation Program", "Acronym with typo matching");
+	is_single_match(MATCHING_ALGORITHM_NORMAL, "vsc", "VisualStudioCode", "Camel case acronym");
+	is_single_match(MATCHING_ALGORITHM_NORMAL, "дм", "Добрый мир", "Cyrillic acronym");
+	isnt_single_match(MATCHING_ALGORITHM_NORMAL, "vsc", "Visual Studio", "Too long acronym");
+	is_span(MATCHING_ALGORITHM_NORMAL, "vs", "Visual Studio", 1, 7, 8, "Acronym span");
+
+	/* Folding. */
+	is_fold("ДОМ", "дом", "Fold");
+	is_fold("\x80\x80\x80", REPLACEMENT REPLACEMENT REPLACEMENT, "Fold stray continuation bytes");
+	is_fold("a\xE2\x82", "a" REPLACEMENT REPLACEMENT, "Fold a truncated sequence");
+	is_fold("\xC3", REPLACEMENT, "Fold a truncated sequence at the end");
+	is_fold("\xFF" "A", REPLACEMENT "a", "Fold an invalid byte");
+	is_fold("\xC0\xAF", REPLACEMENT REPLACEMENT, "Fold an overlong encoding");
+	is_fold("\xED\xA0\x80", REPLACEMENT REPLACEMENT REPLACEMENT, "Fold a surrogate");
+
+	/* Matching strings that aren't valid UTF-8, with spans in bytes. */
+	is_span(MATCHING_ALGORITHM_NORMAL, "ab", "\xE2\x82" "ab", 0, 2, 4, "Substring span after invalid UTF-8");
+	is_span(MATCHING_ALGORITHM_PREFIX, "a", "a\xC3", 0, 0, 1, "Prefix span before a truncated sequence");
+	is_span(MATCHING_ALGORITHM_FUZZY, "b", "\xE2" "b", 0, 1, 2, "Fuzzy span after a truncated sequence");
+	is_span(MATCHING_ALGORITHM_NORMAL, "vs", "Visual\xE2 Studio", 1, 8, 9, "Acronym span after a truncated sequence");
+
+	/* Replacing invalid UTF-8. */
+	char *valid = utf8_make_valid("дом");
+	tap_is(valid, NULL, "Valid UTF-8 is left alone");
+	valid = utf8_make_valid("д\x80" "ом\xD0");
+	tap_is(strcmp(valid, "д" REPLACEMENT "ом" REPLACEMENT), 0, "Replace invalid UTF-8");
+	free(valid);
+
 	tap_plan();
 
 	return EXIT_SUCCESS;